@@ -0,0 +1,405 @@
+#include "pollutil.h"
+#include "log.h"
+#include "errutil.h"
+#include "memutil.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/epoll.h>
+
+/*
+ * epoll has a single registration per file descriptor, so read and write
+ * interest on one socket are folded into the same epoll_event and must
+ * use the same data.  Every registration is allocated once and kept for
+ * the life of the PollState so the pointer stored in epoll_event.data
+ * stays valid across fd reuse.  struct EpollRegistration is declared in
+ * pollresult.h for the ready event accessors.
+ */
+
+struct PollState
+{
+  int epollFD;
+  size_t numReadFDs;
+  size_t numWriteFDs;
+  size_t maxEventsPerWait;
+  struct PollTimers pollTimers;
+  struct EpollRegistration** fdRegistrationArray;
+  size_t fdRegistrationArrayCapacity;
+  struct epoll_event* epollEventArray;
+  size_t epollEventArrayCapacity;
+  struct DynamicArrayUsage epollEventArrayUsage;
+  struct PollResult pollResult;
+};
+
+struct PollState* newPollState(
+  size_t maxEventsPerWait)
+{
+  struct PollState* pollState = checkedCallocOne(sizeof(struct PollState));
+
+  pollState->epollFD = epoll_create1(EPOLL_CLOEXEC);
+  if (pollState->epollFD == -1)
+  {
+    proxyLog("epoll_create1 error errno %d: %s",
+             errno,
+             errnoToString(errno));
+    abort();
+  }
+  proxyLog("created epoll (fd=%d)",
+           pollState->epollFD);
+
+  assert(maxEventsPerWait > 0);
+  pollState->maxEventsPerWait = maxEventsPerWait;
+
+  initPollTimers(&(pollState->pollTimers));
+
+  return pollState;
+}
+
+static size_t getNumRegisteredPollIDs(
+  const struct PollState* pollState)
+{
+  return (pollState->numReadFDs +
+          pollState->numWriteFDs);
+}
+
+static int signalSafeEpollWait(
+  int epfd, struct epoll_event *events,
+  int maxevents, int timeout)
+{
+  bool interrupted;
+  int retVal;
+  do
+  {
+    retVal = epoll_wait(epfd, events, maxevents, timeout);
+    interrupted = ((retVal == -1) &&
+                   (errno == EINTR));
+  } while (interrupted);
+  return retVal;
+}
+
+static struct EpollRegistration* getFDRegistration(
+  struct PollState* pollState,
+  uintptr_t fd)
+{
+  struct EpollRegistration* registration;
+
+  if (fd >= pollState->fdRegistrationArrayCapacity)
+  {
+    const size_t oldCapacity = pollState->fdRegistrationArrayCapacity;
+    pollState->fdRegistrationArray =
+      resizeDynamicArray(
+        pollState->fdRegistrationArray,
+        fd + 1,
+        sizeof(struct EpollRegistration*),
+        &(pollState->fdRegistrationArrayCapacity));
+    memset(pollState->fdRegistrationArray + oldCapacity, 0,
+           (pollState->fdRegistrationArrayCapacity - oldCapacity) *
+           sizeof(struct EpollRegistration*));
+  }
+
+  registration = pollState->fdRegistrationArray[fd];
+  if (registration == NULL)
+  {
+    registration = checkedCallocOne(sizeof(struct EpollRegistration));
+    pollState->fdRegistrationArray[fd] = registration;
+  }
+  registration->fd = fd;
+
+  return registration;
+}
+
+static void setEpollRegistrationData(
+  struct EpollRegistration* registration,
+  void* data)
+{
+  if ((registration->events != 0) &&
+      (registration->data != data))
+  {
+    proxyLog("epoll registration fd %d already has different data",
+             registration->fd);
+    abort();
+  }
+  registration->data = data;
+}
+
+static void updateEpollRegistration(
+  struct PollState* pollState,
+  struct EpollRegistration* registration,
+  uint32_t events)
+{
+  struct epoll_event event;
+  int op;
+
+  if (events == registration->events)
+  {
+    return;
+  }
+  else if (events == 0)
+  {
+    op = EPOLL_CTL_DEL;
+  }
+  else if (registration->events == 0)
+  {
+    op = EPOLL_CTL_ADD;
+  }
+  else
+  {
+    op = EPOLL_CTL_MOD;
+  }
+
+  memset(&event, 0, sizeof(event));
+  event.events = events;
+  event.data.ptr = registration;
+
+  if (epoll_ctl(pollState->epollFD, op, registration->fd, &event) == -1)
+  {
+    proxyLog("epoll_ctl error op %d fd %d events 0x%x errno %d: %s",
+             op,
+             registration->fd,
+             events,
+             errno,
+             errnoToString(errno));
+    abort();
+  }
+
+  registration->events = events;
+}
+
+void addPollFDForRead(
+  struct PollState* pollState,
+  uintptr_t fd,
+  void* data)
+{
+  struct EpollRegistration* registration;
+
+  assert(pollState != NULL);
+
+  registration = getFDRegistration(pollState, fd);
+  setEpollRegistrationData(registration, data);
+  updateEpollRegistration(pollState, registration,
+                          registration->events | EPOLLIN);
+
+  ++(pollState->numReadFDs);
+}
+
+void removePollFDForRead(
+  struct PollState* pollState,
+  uintptr_t fd)
+{
+  struct EpollRegistration* registration;
+
+  assert(pollState != NULL);
+
+  registration = getFDRegistration(pollState, fd);
+  updateEpollRegistration(pollState, registration,
+                          registration->events & ~EPOLLIN);
+
+  --(pollState->numReadFDs);
+}
+
+void addPollFDForWrite(
+  struct PollState* pollState,
+  uintptr_t fd,
+  void* data)
+{
+  struct EpollRegistration* registration;
+
+  assert(pollState != NULL);
+
+  registration = getFDRegistration(pollState, fd);
+  setEpollRegistrationData(registration, data);
+  updateEpollRegistration(pollState, registration,
+                          registration->events | EPOLLOUT);
+
+  ++(pollState->numWriteFDs);
+}
+
+void removePollFDForWrite(
+  struct PollState* pollState,
+  uintptr_t fd)
+{
+  struct EpollRegistration* registration;
+
+  assert(pollState != NULL);
+
+  registration = getFDRegistration(pollState, fd);
+  updateEpollRegistration(pollState, registration,
+                          registration->events & ~EPOLLOUT);
+
+  --(pollState->numWriteFDs);
+}
+
+void addPollTimer(
+  struct PollState* pollState,
+  struct PollTimer* pollTimer,
+  uintptr_t id,
+  void* data,
+  uint32_t timeoutMilliseconds)
+{
+  assert(pollState != NULL);
+
+  startPollTimer(&(pollState->pollTimers), pollTimer,
+                 id, data, timeoutMilliseconds, 0);
+}
+
+void removePollTimer(
+  struct PollState* pollState,
+  struct PollTimer* pollTimer)
+{
+  assert(pollState != NULL);
+
+  stopPollTimer(&(pollState->pollTimers), pollTimer);
+}
+
+void addPollIDForPeriodicTimer(
+  struct PollState* pollState,
+  uintptr_t id,
+  void* data,
+  uint32_t periodMilliseconds)
+{
+  struct PollTimer* pollTimer;
+
+  assert(pollState != NULL);
+
+  pollTimer = checkedCallocOne(sizeof(struct PollTimer));
+  startPollTimer(&(pollState->pollTimers), pollTimer,
+                 id, data, periodMilliseconds, periodMilliseconds);
+}
+
+void flushPollState(
+  struct PollState* pollState)
+{
+  assert(pollState != NULL);
+
+  /* epoll_ctl() has no batched form, changes are applied immediately */
+}
+
+/*
+ * The event array starts small and doubles each time a wait fills it,
+ * up to maxEventsPerWait.  Once it stays mostly unused it shrinks again.
+ */
+static void adjustEpollEventArrayCapacity(
+  struct PollState* pollState,
+  int numEpollEvents,
+  int maxEpollEvents)
+{
+  if ((numEpollEvents == maxEpollEvents) &&
+      (((size_t)maxEpollEvents) < pollState->maxEventsPerWait))
+  {
+    pollState->epollEventArray =
+      resizeDynamicArray(
+        pollState->epollEventArray,
+        maxEpollEvents + 1,
+        sizeof(struct epoll_event),
+        &(pollState->epollEventArrayCapacity));
+  }
+  else
+  {
+    pollState->epollEventArray =
+      shrinkDynamicArray(
+        pollState->epollEventArray,
+        pollState->pollResult.numReadyEvents,
+        sizeof(struct epoll_event),
+        &(pollState->epollEventArrayCapacity),
+        &(pollState->epollEventArrayUsage));
+  }
+}
+
+/* Expired timers are appended to the epoll event array with no event bits
+   set and data.ptr pointing directly to the timer data. */
+static void addTimerEpollEvents(
+  struct PollState* pollState,
+  size_t numEpollEvents,
+  size_t numTimerEpollEvents)
+{
+  struct epoll_event* timerEpollEvent;
+  const struct epoll_event* endTimerEpollEvent;
+
+  pollState->epollEventArray =
+    resizeDynamicArray(
+      pollState->epollEventArray,
+      numEpollEvents + numTimerEpollEvents,
+      sizeof(struct epoll_event),
+      &(pollState->epollEventArrayCapacity));
+
+  timerEpollEvent = pollState->epollEventArray + numEpollEvents;
+  endTimerEpollEvent = timerEpollEvent + numTimerEpollEvents;
+
+  for (; timerEpollEvent != endTimerEpollEvent; ++timerEpollEvent)
+  {
+    const struct PollTimer* pollTimer =
+      popExpiredPollTimer(&(pollState->pollTimers));
+    timerEpollEvent->events = 0;
+    timerEpollEvent->data.ptr = pollTimer->data;
+  }
+}
+
+/*
+ * At most maxEventsPerWait epoll events and maxEventsPerWait timers are
+ * returned per call.  epoll_wait() moves level triggered fds that are
+ * still ready to the tail of the ready list, so fds left over from a full
+ * batch are drained round robin by the following calls.
+ */
+const struct PollResult* blockingPoll(
+  struct PollState* pollState)
+{
+  int retVal;
+  int maxEpollEvents;
+  size_t numTimerEpollEvents;
+
+  assert(pollState != NULL);
+
+  if ((getNumRegisteredPollIDs(pollState) == 0) &&
+      (getNumPollTimers(&(pollState->pollTimers)) == 0))
+  {
+    proxyLog("blockingPool called with no events registered");
+    abort();
+  }
+
+  /* epoll_wait() rejects a zero length event array */
+  pollState->epollEventArray =
+    resizeDynamicArray(
+      pollState->epollEventArray,
+      1,
+      sizeof(struct epoll_event),
+      &(pollState->epollEventArrayCapacity));
+
+  maxEpollEvents = pollState->epollEventArrayCapacity;
+  if (pollState->epollEventArrayCapacity > pollState->maxEventsPerWait)
+  {
+    maxEpollEvents = pollState->maxEventsPerWait;
+  }
+
+  retVal = signalSafeEpollWait(
+    pollState->epollFD,
+    pollState->epollEventArray, maxEpollEvents,
+    getPollTimerWaitMilliseconds(&(pollState->pollTimers)));
+
+  if (retVal == -1)
+  {
+    proxyLog("epoll_wait error errno %d: %s",
+             errno,
+             errnoToString(errno));
+    abort();
+  }
+
+  numTimerEpollEvents = expirePollTimers(&(pollState->pollTimers));
+  if (numTimerEpollEvents > pollState->maxEventsPerWait)
+  {
+    numTimerEpollEvents = pollState->maxEventsPerWait;
+  }
+
+  addTimerEpollEvents(pollState, retVal, numTimerEpollEvents);
+
+  pollState->pollResult.numReadyEvents = retVal + numTimerEpollEvents;
+
+  adjustEpollEventArrayCapacity(pollState, retVal, maxEpollEvents);
+
+  pollState->pollResult.readyEventInfoArray =
+    (const struct ReadyEventInfo*)pollState->epollEventArray;
+
+  return &(pollState->pollResult);
+}
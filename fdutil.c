@@ -1,5 +1,6 @@
 #include "fdutil.h"
 #include <errno.h>
+#include <fcntl.h>
 #include <stdbool.h>
 #include <unistd.h>
 
@@ -17,3 +18,34 @@ bool signalSafeClose(
   } while (interrupted);
   return (closeRetVal != -1);
 }
+
+bool createNonBlockingPipe(
+  int pipeFDArray[2])
+{
+  return (pipe2(pipeFDArray, O_NONBLOCK | O_CLOEXEC) != -1);
+}
+
+bool setFDNonBlocking(
+  int fd)
+{
+  const int flags = fcntl(fd, F_GETFL);
+  if (flags == -1)
+  {
+    return false;
+  }
+  return ((flags & O_NONBLOCK) ||
+          (fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1));
+}
+
+/* F_SETPIPE_SZ only exists on Linux, elsewhere the size is fixed. */
+bool setPipeSize(
+  int pipeFD,
+  size_t pipeSize)
+{
+#ifdef F_SETPIPE_SZ
+  return (fcntl(pipeFD, F_SETPIPE_SZ, (int)pipeSize) != -1);
+#else
+  errno = ENOTSUP;
+  return false;
+#endif
+}
@@ -2,8 +2,19 @@
 #define FDUTIL_H
 
 #include <stdbool.h>
+#include <stddef.h>
 
 bool signalSafeClose(
   int fd);
 
+bool createNonBlockingPipe(
+  int pipeFDArray[2]);
+
+bool setFDNonBlocking(
+  int fd);
+
+bool setPipeSize(
+  int pipeFD,
+  size_t pipeSize);
+
 #endif
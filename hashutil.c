@@ -0,0 +1,28 @@
+#include "hashutil.h"
+
+#define FNV_OFFSET_BASIS (UINT64_C(0xcbf29ce484222325))
+#define FNV_PRIME (UINT64_C(0x100000001b3))
+
+uint64_t hashBytes(
+  const void* bytes,
+  size_t length,
+  uint64_t seed)
+{
+  const unsigned char* byte = bytes;
+  const unsigned char* endByte = byte + length;
+  uint64_t hash = FNV_OFFSET_BASIS ^ seed;
+
+  for (; byte != endByte; ++byte)
+  {
+    hash ^= (*byte);
+    hash *= FNV_PRIME;
+  }
+
+  hash ^= (hash >> 33);
+  hash *= UINT64_C(0xff51afd7ed558ccd);
+  hash ^= (hash >> 33);
+  hash *= UINT64_C(0xc4ceb9fe1a85ec53);
+  hash ^= (hash >> 33);
+
+  return hash;
+}
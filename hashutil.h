@@ -0,0 +1,14 @@
+#ifndef HASHUTIL_H
+#define HASHUTIL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* FNV-1a over the bytes followed by a 64 bit finalizer, so nearby
+   inputs such as consecutive addresses spread over all bits. */
+uint64_t hashBytes(
+  const void* bytes,
+  size_t length,
+  uint64_t seed);
+
+#endif
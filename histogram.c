@@ -0,0 +1,76 @@
+#include "histogram.h"
+#include <assert.h>
+#include <string.h>
+
+static unsigned int getLog2HistogramBucket(
+  uint64_t value)
+{
+  if (value == 0)
+  {
+    return 0;
+  }
+  return (64 - __builtin_clzll(value));
+}
+
+void addLog2HistogramValue(
+  struct Log2Histogram* log2Histogram,
+  uint64_t value)
+{
+  assert(log2Histogram != NULL);
+
+  ++(log2Histogram->count);
+  log2Histogram->sum += value;
+  if (value > log2Histogram->max)
+  {
+    log2Histogram->max = value;
+  }
+  ++(log2Histogram->bucketArray[getLog2HistogramBucket(value)]);
+}
+
+uint64_t getLog2HistogramPercentile(
+  const struct Log2Histogram* log2Histogram,
+  unsigned int percentile)
+{
+  uint64_t targetCount;
+  uint64_t cumulativeCount = 0;
+  unsigned int bucket;
+
+  assert(log2Histogram != NULL);
+  assert(percentile <= 100);
+
+  if (log2Histogram->count == 0)
+  {
+    return 0;
+  }
+
+  targetCount = ((log2Histogram->count * percentile) + 99) / 100;
+  if (targetCount == 0)
+  {
+    targetCount = 1;
+  }
+
+  for (bucket = 0; bucket < LOG2_HISTOGRAM_BUCKETS; ++bucket)
+  {
+    cumulativeCount += log2Histogram->bucketArray[bucket];
+    if (cumulativeCount >= targetCount)
+    {
+      const uint64_t upperBound =
+        ((bucket == 0) ? 0 :
+         (bucket == 64) ? UINT64_MAX :
+         ((((uint64_t)1) << bucket) - 1));
+      return ((upperBound < log2Histogram->max) ?
+              upperBound :
+              log2Histogram->max);
+    }
+  }
+
+  return log2Histogram->max;
+}
+
+void resetLog2Histogram(
+  struct Log2Histogram* log2Histogram)
+{
+  assert(log2Histogram != NULL);
+
+  memset(log2Histogram, 0, sizeof(struct Log2Histogram));
+}
@@ -0,0 +1,29 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+/* Bucket 0 counts zero values, bucket i counts [2^(i-1), 2^i). */
+#define LOG2_HISTOGRAM_BUCKETS (65)
+
+struct Log2Histogram
+{
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+  uint64_t bucketArray[LOG2_HISTOGRAM_BUCKETS];
+};
+
+void addLog2HistogramValue(
+  struct Log2Histogram* log2Histogram,
+  uint64_t value);
+
+/* Upper bound of the bucket holding the given percentile, 0 if empty. */
+uint64_t getLog2HistogramPercentile(
+  const struct Log2Histogram* log2Histogram,
+  unsigned int percentile);
+
+void resetLog2Histogram(
+  struct Log2Histogram* log2Histogram);
+
+#endif
@@ -0,0 +1,677 @@
+#include "pollutil.h"
+#include "log.h"
+#include "errutil.h"
+#include "memutil.h"
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+
+/*
+ * Readiness is watched with one shot IORING_OP_POLL_ADD requests, one per
+ * registered fd.  A completed poll is armed again by the next
+ * blockingPoll() if the fd is still registered, so an fd that stays ready
+ * is reported again like a level triggered epoll or kqueue registration.
+ * Registration changes and rearms are queued on the submission ring and
+ * handed to the kernel by the same io_uring_enter() call that waits for
+ * completions, so a loop iteration costs one system call however many
+ * fds changed.
+ *
+ * Each poll request's user_data holds the fd and a per registration
+ * generation.  Completions of requests that were removed or replaced
+ * since, including those for an earlier fd with the same number, no
+ * longer match the registration and are dropped.  Like the epoll
+ * backend, every registration is allocated once and kept for the life
+ * of the PollState.  struct IOUringRegistration is declared in
+ * pollresult.h for the ready event accessors.
+ */
+
+#define RING_ENTRIES (1024)
+
+#define POLL_REMOVE_USER_DATA (UINT64_MAX)
+
+struct SubmissionRing
+{
+  unsigned* head;
+  unsigned* tail;
+  unsigned mask;
+  unsigned entries;
+  unsigned* array;
+  struct io_uring_sqe* sqeArray;
+  unsigned numUnsubmitted;
+};
+
+struct CompletionRing
+{
+  unsigned* head;
+  unsigned* tail;
+  unsigned mask;
+  struct io_uring_cqe* cqeArray;
+};
+
+struct PollState
+{
+  int ringFD;
+  size_t numReadFDs;
+  size_t numWriteFDs;
+  size_t maxEventsPerWait;
+  struct PollTimers pollTimers;
+  struct SubmissionRing submissionRing;
+  struct CompletionRing completionRing;
+  struct IOUringRegistration** fdRegistrationArray;
+  size_t fdRegistrationArrayCapacity;
+  int* changedFDArray;
+  size_t numChangedFDs;
+  size_t changedFDArrayCapacity;
+  struct ReadyEventInfo* readyEventInfoArray;
+  size_t readyEventInfoArrayCapacity;
+  struct DynamicArrayUsage readyEventInfoArrayUsage;
+  struct PollResult pollResult;
+};
+
+static int ioUringSetup(
+  unsigned entries,
+  struct io_uring_params* params)
+{
+  return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int ioUringEnter(
+  int ringFD,
+  unsigned toSubmit,
+  unsigned minComplete,
+  unsigned flags,
+  const struct io_uring_getevents_arg* getEventsArg)
+{
+  return syscall(__NR_io_uring_enter, ringFD, toSubmit, minComplete, flags,
+                 getEventsArg,
+                 (getEventsArg != NULL) ? sizeof(*getEventsArg) : 0);
+}
+
+static void* mapRing(
+  int ringFD,
+  size_t size,
+  off_t offset)
+{
+  void* ring = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ringFD, offset);
+  if (ring == MAP_FAILED)
+  {
+    proxyLog("io_uring mmap error offset %jd errno %d: %s",
+             (intmax_t)offset,
+             errno,
+             errnoToString(errno));
+    abort();
+  }
+  return ring;
+}
+
+static void mapRings(
+  struct PollState* pollState,
+  const struct io_uring_params* params)
+{
+  size_t sqRingSize =
+    params->sq_off.array + (params->sq_entries * sizeof(unsigned));
+  size_t cqRingSize =
+    params->cq_off.cqes + (params->cq_entries * sizeof(struct io_uring_cqe));
+  unsigned char* sqRing;
+  unsigned char* cqRing;
+
+  /* both rings share one mapping, sized for the larger */
+  if (cqRingSize > sqRingSize)
+  {
+    sqRingSize = cqRingSize;
+  }
+  sqRing = mapRing(pollState->ringFD, sqRingSize, IORING_OFF_SQ_RING);
+  cqRing = sqRing;
+
+  pollState->submissionRing.head = (unsigned*)(sqRing + params->sq_off.head);
+  pollState->submissionRing.tail = (unsigned*)(sqRing + params->sq_off.tail);
+  pollState->submissionRing.mask =
+    *((unsigned*)(sqRing + params->sq_off.ring_mask));
+  pollState->submissionRing.entries =
+    *((unsigned*)(sqRing + params->sq_off.ring_entries));
+  pollState->submissionRing.array =
+    (unsigned*)(sqRing + params->sq_off.array);
+  pollState->submissionRing.sqeArray =
+    mapRing(pollState->ringFD,
+            params->sq_entries * sizeof(struct io_uring_sqe),
+            IORING_OFF_SQES);
+
+  pollState->completionRing.head = (unsigned*)(cqRing + params->cq_off.head);
+  pollState->completionRing.tail = (unsigned*)(cqRing + params->cq_off.tail);
+  pollState->completionRing.mask =
+    *((unsigned*)(cqRing + params->cq_off.ring_mask));
+  pollState->completionRing.cqeArray =
+    (struct io_uring_cqe*)(cqRing + params->cq_off.cqes);
+}
+
+struct PollState* newPollState(
+  size_t maxEventsPerWait)
+{
+  struct PollState* pollState = checkedCallocOne(sizeof(struct PollState));
+  struct io_uring_params params;
+  const uint32_t requiredFeatures =
+    IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+
+  memset(&params, 0, sizeof(params));
+  pollState->ringFD = ioUringSetup(RING_ENTRIES, &params);
+  if (pollState->ringFD == -1)
+  {
+    proxyLog("io_uring_setup error errno %d: %s",
+             errno,
+             errnoToString(errno));
+    abort();
+  }
+  if ((params.features & requiredFeatures) != requiredFeatures)
+  {
+    proxyLog("io_uring features 0x%x missing required 0x%x",
+             params.features,
+             requiredFeatures);
+    abort();
+  }
+  mapRings(pollState, &params);
+  proxyLog("created io_uring (fd=%d)",
+           pollState->ringFD);
+
+  assert(maxEventsPerWait > 0);
+  pollState->maxEventsPerWait = maxEventsPerWait;
+
+  initPollTimers(&(pollState->pollTimers));
+
+  return pollState;
+}
+
+static size_t getNumRegisteredPollIDs(
+  const struct PollState* pollState)
+{
+  return (pollState->numReadFDs +
+          pollState->numWriteFDs);
+}
+
+/*
+ * Submits queued entries and, if getEventsArg is not NULL, waits for at
+ * least one completion or the timeout in it.  A wait that times out is
+ * not an error.
+ */
+static void enterRing(
+  struct PollState* pollState,
+  const struct io_uring_getevents_arg* getEventsArg)
+{
+  struct SubmissionRing* submissionRing = &(pollState->submissionRing);
+  unsigned minComplete = 0;
+  unsigned flags = 0;
+  bool interrupted;
+  int retVal;
+
+  if (getEventsArg != NULL)
+  {
+    minComplete = 1;
+    flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+  }
+
+  do
+  {
+    retVal = ioUringEnter(pollState->ringFD,
+                          submissionRing->numUnsubmitted,
+                          minComplete, flags, getEventsArg);
+    if (retVal > 0)
+    {
+      submissionRing->numUnsubmitted -= retVal;
+    }
+    interrupted = ((retVal == -1) &&
+                   (errno == EINTR));
+  } while (interrupted ||
+           ((retVal >= 0) && (submissionRing->numUnsubmitted > 0)));
+
+  if ((retVal == -1) && (errno != ETIME))
+  {
+    proxyLog("io_uring_enter error errno %d: %s",
+             errno,
+             errnoToString(errno));
+    abort();
+  }
+}
+
+static struct io_uring_sqe* getSubmissionEntry(
+  struct PollState* pollState)
+{
+  struct SubmissionRing* submissionRing = &(pollState->submissionRing);
+  unsigned tail = *(submissionRing->tail);
+  unsigned index;
+  struct io_uring_sqe* sqe;
+
+  if ((tail - __atomic_load_n(submissionRing->head, __ATOMIC_ACQUIRE)) ==
+      submissionRing->entries)
+  {
+    enterRing(pollState, NULL);
+  }
+
+  index = tail & submissionRing->mask;
+  sqe = submissionRing->sqeArray + index;
+  memset(sqe, 0, sizeof(*sqe));
+  submissionRing->array[index] = index;
+  return sqe;
+}
+
+static void pushSubmissionEntry(
+  struct PollState* pollState)
+{
+  struct SubmissionRing* submissionRing = &(pollState->submissionRing);
+
+  __atomic_store_n(submissionRing->tail, *(submissionRing->tail) + 1,
+                   __ATOMIC_RELEASE);
+  ++(submissionRing->numUnsubmitted);
+}
+
+static void submitPollAdd(
+  struct PollState* pollState,
+  struct IOUringRegistration* registration)
+{
+  struct io_uring_sqe* sqe = getSubmissionEntry(pollState);
+
+  ++(registration->generation);
+  registration->armed = true;
+  registration->armedEvents = registration->events;
+  registration->armedUserData =
+    (((uint64_t)registration->fd) << 32) | registration->generation;
+
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = registration->fd;
+  sqe->poll32_events = registration->armedEvents;
+  sqe->user_data = registration->armedUserData;
+  pushSubmissionEntry(pollState);
+}
+
+static void submitPollRemove(
+  struct PollState* pollState,
+  struct IOUringRegistration* registration)
+{
+  struct io_uring_sqe* sqe = getSubmissionEntry(pollState);
+
+  registration->armed = false;
+
+  sqe->opcode = IORING_OP_POLL_REMOVE;
+  sqe->fd = -1;
+  sqe->addr = registration->armedUserData;
+  sqe->user_data = POLL_REMOVE_USER_DATA;
+  pushSubmissionEntry(pollState);
+}
+
+static struct IOUringRegistration* getFDRegistration(
+  struct PollState* pollState,
+  uintptr_t fd)
+{
+  struct IOUringRegistration* registration;
+
+  if (fd >= pollState->fdRegistrationArrayCapacity)
+  {
+    const size_t oldCapacity = pollState->fdRegistrationArrayCapacity;
+    pollState->fdRegistrationArray =
+      resizeDynamicArray(
+        pollState->fdRegistrationArray,
+        fd + 1,
+        sizeof(struct IOUringRegistration*),
+        &(pollState->fdRegistrationArrayCapacity));
+    memset(pollState->fdRegistrationArray + oldCapacity, 0,
+           (pollState->fdRegistrationArrayCapacity - oldCapacity) *
+           sizeof(struct IOUringRegistration*));
+  }
+
+  registration = pollState->fdRegistrationArray[fd];
+  if (registration == NULL)
+  {
+    registration = checkedCallocOne(sizeof(struct IOUringRegistration));
+    pollState->fdRegistrationArray[fd] = registration;
+  }
+  registration->fd = fd;
+
+  return registration;
+}
+
+static void setIOUringRegistrationData(
+  struct IOUringRegistration* registration,
+  void* data)
+{
+  if ((registration->events != 0) &&
+      (registration->data != data))
+  {
+    proxyLog("io_uring registration fd %d already has different data",
+             registration->fd);
+    abort();
+  }
+  registration->data = data;
+}
+
+static void markIOUringRegistrationChanged(
+  struct PollState* pollState,
+  struct IOUringRegistration* registration)
+{
+  if (registration->changed)
+  {
+    return;
+  }
+
+  pollState->changedFDArray =
+    resizeDynamicArray(
+      pollState->changedFDArray,
+      pollState->numChangedFDs + 1,
+      sizeof(int),
+      &(pollState->changedFDArrayCapacity));
+  pollState->changedFDArray[pollState->numChangedFDs] = registration->fd;
+  ++(pollState->numChangedFDs);
+
+  registration->changed = true;
+}
+
+static void updateIOUringRegistration(
+  struct PollState* pollState,
+  struct IOUringRegistration* registration,
+  uint32_t events)
+{
+  registration->events = events;
+  markIOUringRegistrationChanged(pollState, registration);
+}
+
+/* Queues the poll requests for every registration changed or completed
+   since the last call. */
+static void queueChangedRegistrations(
+  struct PollState* pollState)
+{
+  size_t i;
+
+  for (i = 0; i < pollState->numChangedFDs; ++i)
+  {
+    struct IOUringRegistration* registration =
+      pollState->fdRegistrationArray[pollState->changedFDArray[i]];
+
+    registration->changed = false;
+
+    if (registration->armed &&
+        (registration->armedEvents != registration->events))
+    {
+      submitPollRemove(pollState, registration);
+    }
+
+    if ((!registration->armed) &&
+        (registration->events != 0))
+    {
+      submitPollAdd(pollState, registration);
+    }
+  }
+
+  pollState->numChangedFDs = 0;
+}
+
+void addPollFDForRead(
+  struct PollState* pollState,
+  uintptr_t fd,
+  void* data)
+{
+  struct IOUringRegistration* registration;
+
+  assert(pollState != NULL);
+
+  registration = getFDRegistration(pollState, fd);
+  setIOUringRegistrationData(registration, data);
+  updateIOUringRegistration(pollState, registration,
+                            registration->events | POLLIN);
+
+  ++(pollState->numReadFDs);
+}
+
+void removePollFDForRead(
+  struct PollState* pollState,
+  uintptr_t fd)
+{
+  struct IOUringRegistration* registration;
+
+  assert(pollState != NULL);
+
+  registration = getFDRegistration(pollState, fd);
+  updateIOUringRegistration(pollState, registration,
+                            registration->events & ~POLLIN);
+
+  --(pollState->numReadFDs);
+}
+
+void addPollFDForWrite(
+  struct PollState* pollState,
+  uintptr_t fd,
+  void* data)
+{
+  struct IOUringRegistration* registration;
+
+  assert(pollState != NULL);
+
+  registration = getFDRegistration(pollState, fd);
+  setIOUringRegistrationData(registration, data);
+  updateIOUringRegistration(pollState, registration,
+                            registration->events | POLLOUT);
+
+  ++(pollState->numWriteFDs);
+}
+
+void removePollFDForWrite(
+  struct PollState* pollState,
+  uintptr_t fd)
+{
+  struct IOUringRegistration* registration;
+
+  assert(pollState != NULL);
+
+  registration = getFDRegistration(pollState, fd);
+  updateIOUringRegistration(pollState, registration,
+                            registration->events & ~POLLOUT);
+
+  --(pollState->numWriteFDs);
+}
+
+void addPollTimer(
+  struct PollState* pollState,
+  struct PollTimer* pollTimer,
+  uintptr_t id,
+  void* data,
+  uint32_t timeoutMilliseconds)
+{
+  assert(pollState != NULL);
+
+  startPollTimer(&(pollState->pollTimers), pollTimer,
+                 id, data, timeoutMilliseconds, 0);
+}
+
+void removePollTimer(
+  struct PollState* pollState,
+  struct PollTimer* pollTimer)
+{
+  assert(pollState != NULL);
+
+  stopPollTimer(&(pollState->pollTimers), pollTimer);
+}
+
+void addPollIDForPeriodicTimer(
+  struct PollState* pollState,
+  uintptr_t id,
+  void* data,
+  uint32_t periodMilliseconds)
+{
+  struct PollTimer* pollTimer;
+
+  assert(pollState != NULL);
+
+  pollTimer = checkedCallocOne(sizeof(struct PollTimer));
+  startPollTimer(&(pollState->pollTimers), pollTimer,
+                 id, data, periodMilliseconds, periodMilliseconds);
+}
+
+/* A poll request holds a reference to its file, so removals must reach
+   the kernel before the fd is closed or the socket stays open. */
+void flushPollState(
+  struct PollState* pollState)
+{
+  assert(pollState != NULL);
+
+  queueChangedRegistrations(pollState);
+  if (pollState->submissionRing.numUnsubmitted > 0)
+  {
+    enterRing(pollState, NULL);
+  }
+}
+
+static void addReadyEventInfo(
+  struct PollState* pollState,
+  size_t index,
+  uint32_t events,
+  void* ptr)
+{
+  pollState->readyEventInfoArray =
+    resizeDynamicArray(
+      pollState->readyEventInfoArray,
+      index + 1,
+      sizeof(struct ReadyEventInfo),
+      &(pollState->readyEventInfoArrayCapacity));
+
+  pollState->readyEventInfoArray[index].events = events;
+  pollState->readyEventInfoArray[index].ptr = ptr;
+}
+
+/*
+ * Reaps up to maxEventsPerWait poll completions into the ready event
+ * array.  Completions left over stay on the ring for the next call.
+ * Each reported registration is marked changed so it is armed again.
+ */
+static size_t reapCompletions(
+  struct PollState* pollState)
+{
+  struct CompletionRing* completionRing = &(pollState->completionRing);
+  const unsigned tail =
+    __atomic_load_n(completionRing->tail, __ATOMIC_ACQUIRE);
+  unsigned head = *(completionRing->head);
+  size_t numReadyEvents = 0;
+
+  for (;
+       (head != tail) && (numReadyEvents < pollState->maxEventsPerWait);
+       ++head)
+  {
+    const struct io_uring_cqe* cqe =
+      completionRing->cqeArray + (head & completionRing->mask);
+    const uint64_t userData = cqe->user_data;
+    const uint64_t fd = userData >> 32;
+    struct IOUringRegistration* registration;
+
+    if ((userData == POLL_REMOVE_USER_DATA) ||
+        (fd >= pollState->fdRegistrationArrayCapacity))
+    {
+      continue;
+    }
+
+    registration = pollState->fdRegistrationArray[fd];
+    if ((registration == NULL) ||
+        (!registration->armed) ||
+        (registration->armedUserData != userData))
+    {
+      continue;
+    }
+
+    registration->armed = false;
+    markIOUringRegistrationChanged(pollState, registration);
+
+    addReadyEventInfo(pollState, numReadyEvents,
+                      (cqe->res < 0) ? POLLERR : (uint32_t)cqe->res,
+                      registration);
+    ++numReadyEvents;
+  }
+
+  __atomic_store_n(completionRing->head, head, __ATOMIC_RELEASE);
+
+  return numReadyEvents;
+}
+
+/* Expired timers are appended to the ready event array with no event
+   bits set and ptr pointing directly to the timer data. */
+static void addTimerReadyEvents(
+  struct PollState* pollState,
+  size_t numReadyEvents,
+  size_t numTimerReadyEvents)
+{
+  size_t i;
+
+  for (i = 0; i < numTimerReadyEvents; ++i)
+  {
+    const struct PollTimer* pollTimer =
+      popExpiredPollTimer(&(pollState->pollTimers));
+    addReadyEventInfo(pollState, numReadyEvents + i, 0, pollTimer->data);
+  }
+}
+
+/*
+ * At most maxEventsPerWait poll completions and maxEventsPerWait timers
+ * are returned per call.  An fd reported by one call is only armed again
+ * by the next, after every fd reported before it, so fds that stay ready
+ * are drained round robin.
+ */
+const struct PollResult* blockingPoll(
+  struct PollState* pollState)
+{
+  int waitMilliseconds;
+  size_t numReadyEvents;
+  size_t numTimerReadyEvents;
+  struct __kernel_timespec waitTimespec;
+  struct io_uring_getevents_arg getEventsArg;
+
+  assert(pollState != NULL);
+
+  if ((getNumRegisteredPollIDs(pollState) == 0) &&
+      (getNumPollTimers(&(pollState->pollTimers)) == 0))
+  {
+    proxyLog("blockingPool called with no events registered");
+    abort();
+  }
+
+  queueChangedRegistrations(pollState);
+
+  memset(&getEventsArg, 0, sizeof(getEventsArg));
+  getEventsArg.sigmask_sz = _NSIG / 8;
+  waitMilliseconds = getPollTimerWaitMilliseconds(&(pollState->pollTimers));
+  if (waitMilliseconds >= 0)
+  {
+    waitTimespec.tv_sec = waitMilliseconds / 1000;
+    waitTimespec.tv_nsec = (waitMilliseconds % 1000) * 1000000L;
+    getEventsArg.ts = (uint64_t)(uintptr_t)&waitTimespec;
+  }
+
+  enterRing(pollState, &getEventsArg);
+
+  numReadyEvents = reapCompletions(pollState);
+
+  numTimerReadyEvents = expirePollTimers(&(pollState->pollTimers));
+  if (numTimerReadyEvents > pollState->maxEventsPerWait)
+  {
+    numTimerReadyEvents = pollState->maxEventsPerWait;
+  }
+
+  addTimerReadyEvents(pollState, numReadyEvents, numTimerReadyEvents);
+
+  pollState->pollResult.numReadyEvents = numReadyEvents + numTimerReadyEvents;
+
+  pollState->readyEventInfoArray =
+    shrinkDynamicArray(
+      pollState->readyEventInfoArray,
+      pollState->pollResult.numReadyEvents,
+      sizeof(struct ReadyEventInfo),
+      &(pollState->readyEventInfoArrayCapacity),
+      &(pollState->readyEventInfoArrayUsage));
+
+  pollState->pollResult.readyEventInfoArray =
+    pollState->readyEventInfoArray;
+
+  return &(pollState->pollResult);
+}
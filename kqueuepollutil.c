@@ -0,0 +1,393 @@
+#include "pollutil.h"
+#include "log.h"
+#include "errutil.h"
+#include "memutil.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/time.h>
+
+struct PollState
+{
+  int kqueueFD;
+  size_t numReadFDs;
+  size_t numWriteFDs;
+  size_t maxEventsPerWait;
+  struct PollTimers pollTimers;
+  struct kevent* changeArray;
+  size_t numChanges;
+  size_t changeArrayCapacity;
+  struct kevent* keventArray;
+  size_t keventArrayCapacity;
+  struct DynamicArrayUsage keventArrayUsage;
+  struct PollResult pollResult;
+};
+
+struct PollState* newPollState(
+  size_t maxEventsPerWait)
+{
+  struct PollState* pollState = checkedCallocOne(sizeof(struct PollState));
+
+  pollState->kqueueFD = kqueue();
+  if (pollState->kqueueFD == -1)
+  {
+    proxyLog("kqueue error errno %d: %s",
+             errno,
+             errnoToString(errno));
+    abort();
+  }
+  proxyLog("created kqueue (fd=%d)",
+           pollState->kqueueFD);
+
+  assert(maxEventsPerWait > 0);
+  pollState->maxEventsPerWait = maxEventsPerWait;
+
+  initPollTimers(&(pollState->pollTimers));
+
+  return pollState;
+}
+
+static size_t getNumRegisteredPollIDs(
+  const struct PollState* pollState)
+{
+  return (pollState->numReadFDs +
+          pollState->numWriteFDs);
+}
+
+static int signalSafeKevent(
+  int kq, const struct kevent *changelist, int nchanges,
+  struct kevent *eventlist, int nevents,
+  const struct timespec *timeout)
+{
+  bool interrupted;
+  int retVal;
+  do
+  {
+    retVal = kevent(
+      kq, changelist, nchanges,
+      eventlist, nevents,
+      timeout);
+    interrupted = ((retVal == -1) &&
+                   (errno == EINTR));
+  } while (interrupted);
+  return retVal;
+}
+
+/*
+ * Changes are queued and handed to the kernel together with the next
+ * kevent() wait in blockingPoll(), or earlier by flushPollState().
+ */
+static void addChange(
+  struct PollState* pollState,
+  uintptr_t ident,
+  short filter,
+  unsigned short flags,
+  int64_t data,
+  void* udata)
+{
+  pollState->changeArray =
+    resizeDynamicArray(
+      pollState->changeArray,
+      pollState->numChanges + 1,
+      sizeof(struct kevent),
+      &(pollState->changeArrayCapacity));
+
+  EV_SET(pollState->changeArray + pollState->numChanges,
+         ident, filter, flags, 0, data, udata);
+
+  ++(pollState->numChanges);
+}
+
+void addPollFDForRead(
+  struct PollState* pollState,
+  uintptr_t fd,
+  void* data)
+{
+  assert(pollState != NULL);
+
+  addChange(pollState, fd, EVFILT_READ, EV_ADD, 0, data);
+
+  ++(pollState->numReadFDs);
+}
+
+void removePollFDForRead(
+  struct PollState* pollState,
+  uintptr_t fd)
+{
+  assert(pollState != NULL);
+
+  addChange(pollState, fd, EVFILT_READ, EV_DELETE, 0, NULL);
+
+  --(pollState->numReadFDs);
+}
+
+void addPollFDForWrite(
+  struct PollState* pollState,
+  uintptr_t fd,
+  void* data)
+{
+  assert(pollState != NULL);
+
+  addChange(pollState, fd, EVFILT_WRITE, EV_ADD, 0, data);
+
+  ++(pollState->numWriteFDs);
+}
+
+void removePollFDForWrite(
+  struct PollState* pollState,
+  uintptr_t fd)
+{
+  assert(pollState != NULL);
+
+  addChange(pollState, fd, EVFILT_WRITE, EV_DELETE, 0, NULL);
+
+  --(pollState->numWriteFDs);
+}
+
+void addPollTimer(
+  struct PollState* pollState,
+  struct PollTimer* pollTimer,
+  uintptr_t id,
+  void* data,
+  uint32_t timeoutMilliseconds)
+{
+  assert(pollState != NULL);
+
+  startPollTimer(&(pollState->pollTimers), pollTimer,
+                 id, data, timeoutMilliseconds, 0);
+}
+
+void removePollTimer(
+  struct PollState* pollState,
+  struct PollTimer* pollTimer)
+{
+  assert(pollState != NULL);
+
+  stopPollTimer(&(pollState->pollTimers), pollTimer);
+}
+
+void addPollIDForPeriodicTimer(
+  struct PollState* pollState,
+  uintptr_t id,
+  void* data,
+  uint32_t periodMilliseconds)
+{
+  struct PollTimer* pollTimer;
+
+  assert(pollState != NULL);
+
+  pollTimer = checkedCallocOne(sizeof(struct PollTimer));
+  startPollTimer(&(pollState->pollTimers), pollTimer,
+                 id, data, periodMilliseconds, periodMilliseconds);
+}
+
+void flushPollState(
+  struct PollState* pollState)
+{
+  int retVal;
+
+  assert(pollState != NULL);
+
+  if (pollState->numChanges == 0)
+  {
+    return;
+  }
+
+  retVal = signalSafeKevent(
+    pollState->kqueueFD,
+    pollState->changeArray, pollState->numChanges,
+    NULL, 0,
+    NULL);
+  if (retVal == -1)
+  {
+    proxyLog("kevent flush %zu changes error errno %d: %s",
+             pollState->numChanges,
+             errno,
+             errnoToString(errno));
+    abort();
+  }
+
+  pollState->numChanges = 0;
+}
+
+static void checkChangeError(
+  const struct kevent* readyKEvent)
+{
+  if (readyKEvent->flags & EV_ERROR)
+  {
+    proxyLog("kevent change error ident %ju filter %d errno %jd: %s",
+             (uintmax_t)readyKEvent->ident,
+             readyKEvent->filter,
+             (intmax_t)readyKEvent->data,
+             errnoToString(readyKEvent->data));
+    abort();
+  }
+}
+
+/*
+ * The event array starts small and doubles each time a wait fills it,
+ * up to maxEventsPerWait.  Once it stays mostly unused it shrinks again.
+ */
+static void adjustKeventArrayCapacity(
+  struct PollState* pollState,
+  int numKEvents,
+  int maxKEvents)
+{
+  if ((numKEvents == maxKEvents) &&
+      (((size_t)maxKEvents) < pollState->maxEventsPerWait))
+  {
+    pollState->keventArray =
+      resizeDynamicArray(
+        pollState->keventArray,
+        maxKEvents + 1,
+        sizeof(struct kevent),
+        &(pollState->keventArrayCapacity));
+  }
+  else
+  {
+    pollState->keventArray =
+      shrinkDynamicArray(
+        pollState->keventArray,
+        pollState->pollResult.numReadyEvents,
+        sizeof(struct kevent),
+        &(pollState->keventArrayCapacity),
+        &(pollState->keventArrayUsage));
+  }
+}
+
+/* Expired timers are appended to the kevent array as EVFILT_TIMER events. */
+static void addTimerKEvents(
+  struct PollState* pollState,
+  size_t numKEvents,
+  size_t numTimerKEvents)
+{
+  struct kevent* timerKEvent;
+  const struct kevent* endTimerKEvent;
+
+  pollState->keventArray =
+    resizeDynamicArray(
+      pollState->keventArray,
+      numKEvents + numTimerKEvents,
+      sizeof(struct kevent),
+      &(pollState->keventArrayCapacity));
+
+  timerKEvent = pollState->keventArray + numKEvents;
+  endTimerKEvent = timerKEvent + numTimerKEvents;
+
+  for (; timerKEvent != endTimerKEvent; ++timerKEvent)
+  {
+    const struct PollTimer* pollTimer =
+      popExpiredPollTimer(&(pollState->pollTimers));
+    EV_SET(timerKEvent, pollTimer->id, EVFILT_TIMER, 0, 0, 0,
+           pollTimer->data);
+  }
+}
+
+/*
+ * At most maxEventsPerWait kernel events and maxEventsPerWait timers are
+ * returned per call.  Level triggered knotes that are still active are
+ * put back at the tail of the kqueue's active list when collected, so
+ * fds left over from a full batch are drained round robin by the
+ * following calls rather than starving anything behind them.
+ */
+const struct PollResult* blockingPoll(
+  struct PollState* pollState)
+{
+  int retVal;
+  int waitMilliseconds;
+  int maxKEvents;
+  size_t numChanges;
+  size_t numTimerKEvents;
+  struct timespec waitTimespec;
+  struct timespec* waitTimespecPointer = NULL;
+
+  assert(pollState != NULL);
+
+  if ((getNumRegisteredPollIDs(pollState) == 0) &&
+      (getNumPollTimers(&(pollState->pollTimers)) == 0))
+  {
+    proxyLog("blockingPool called with no events registered");
+    abort();
+  }
+
+  /* kevent() must be given room for at least one event or change error */
+  pollState->keventArray =
+    resizeDynamicArray(
+      pollState->keventArray,
+      1,
+      sizeof(struct kevent),
+      &(pollState->keventArrayCapacity));
+
+  maxKEvents = pollState->keventArrayCapacity;
+  if (pollState->keventArrayCapacity > pollState->maxEventsPerWait)
+  {
+    maxKEvents = pollState->maxEventsPerWait;
+  }
+
+  waitMilliseconds = getPollTimerWaitMilliseconds(&(pollState->pollTimers));
+  if (waitMilliseconds >= 0)
+  {
+    waitTimespec.tv_sec = waitMilliseconds / 1000;
+    waitTimespec.tv_nsec = (waitMilliseconds % 1000) * 1000000L;
+    waitTimespecPointer = &waitTimespec;
+  }
+
+  /*
+   * Queued changes are applied before kevent() sleeps, so after EINTR
+   * only the wait is retried.  A failed change comes back in the event
+   * list with EV_ERROR set.
+   */
+  numChanges = pollState->numChanges;
+  retVal = kevent(
+    pollState->kqueueFD,
+    pollState->changeArray, numChanges,
+    pollState->keventArray, maxKEvents,
+    waitTimespecPointer);
+  if ((retVal == -1) && (errno == EINTR))
+  {
+    retVal = signalSafeKevent(
+      pollState->kqueueFD,
+      NULL, 0,
+      pollState->keventArray, maxKEvents,
+      waitTimespecPointer);
+  }
+  pollState->numChanges = 0;
+
+  if (retVal == -1)
+  {
+    proxyLog("kevent wait error errno %d: %s",
+             errno,
+             errnoToString(errno));
+    abort();
+  }
+
+  if (numChanges > 0)
+  {
+    const struct kevent* readyKEvent = pollState->keventArray;
+    const struct kevent* endReadyKEvent = readyKEvent + retVal;
+    for (; readyKEvent != endReadyKEvent; ++readyKEvent)
+    {
+      checkChangeError(readyKEvent);
+    }
+  }
+
+  numTimerKEvents = expirePollTimers(&(pollState->pollTimers));
+  if (numTimerKEvents > pollState->maxEventsPerWait)
+  {
+    numTimerKEvents = pollState->maxEventsPerWait;
+  }
+
+  addTimerKEvents(pollState, retVal, numTimerKEvents);
+
+  pollState->pollResult.numReadyEvents = retVal + numTimerKEvents;
+
+  adjustKeventArrayCapacity(pollState, retVal, maxKEvents);
+
+  pollState->pollResult.readyEventInfoArray =
+    (const struct ReadyEventInfo*)pollState->keventArray;
+
+  return &(pollState->pollResult);
+}
@@ -15,6 +15,9 @@ void proxyLogSetFlush(bool enabled)
 
 static void internalProxyLog(bool time, const char* format, va_list args)
 {
+  /* keep lines from different event loop threads whole */
+  flockfile(stdout);
+
   if (time)
   {
     printTimeString(stdout);
@@ -28,6 +31,8 @@ static void internalProxyLog(bool time, const char* format, va_list args)
   {
     fflush(stdout);
   }
+
+  funlockfile(stdout);
 }
 
 void proxyLog(const char* format, ...)
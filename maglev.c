@@ -0,0 +1,151 @@
+#include "maglev.h"
+#include "memutil.h"
+#include <assert.h>
+
+/*
+ * Each backend walks the table in its own permutation,
+ * (offset + j * skip) mod size, and backends take turns claiming their
+ * next free slot until the table is full.  A prime table size at least
+ * MIN_SLOTS_PER_BACKEND times the backend count keeps every backend's
+ * share within about a percent.
+ */
+
+#define MIN_SLOTS_PER_BACKEND (100)
+
+static const size_t tableSizeArray[] =
+{
+  251, 509, 1021, 2039, 4093, 8191, 16381, 32749, 65521,
+  131071, 262139, 524287, 1048573
+};
+
+#define NUM_TABLE_SIZES (sizeof(tableSizeArray) / sizeof(tableSizeArray[0]))
+
+struct MaglevTable
+{
+  size_t tableSize;
+  size_t numBackends;
+  size_t* offsetArray;
+  size_t* skipArray;
+  size_t* nextArray;
+  size_t* entryArray;
+};
+
+struct MaglevTable* newMaglevTable(
+  const uint64_t* backendNameHashArray,
+  size_t numBackends)
+{
+  struct MaglevTable* maglevTable =
+    checkedCallocOne(sizeof(struct MaglevTable));
+  size_t i;
+
+  maglevTable->tableSize = tableSizeArray[NUM_TABLE_SIZES - 1];
+  for (i = 0; i < NUM_TABLE_SIZES; ++i)
+  {
+    if ((tableSizeArray[i] / MIN_SLOTS_PER_BACKEND) >= numBackends)
+    {
+      maglevTable->tableSize = tableSizeArray[i];
+      break;
+    }
+  }
+
+  maglevTable->numBackends = numBackends;
+  maglevTable->offsetArray =
+    checkedReallocarray(NULL, numBackends, sizeof(size_t));
+  maglevTable->skipArray =
+    checkedReallocarray(NULL, numBackends, sizeof(size_t));
+  maglevTable->nextArray =
+    checkedReallocarray(NULL, numBackends, sizeof(size_t));
+  maglevTable->entryArray =
+    checkedReallocarray(NULL, maglevTable->tableSize, sizeof(size_t));
+
+  for (i = 0; i < numBackends; ++i)
+  {
+    const uint64_t nameHash = backendNameHashArray[i];
+    maglevTable->offsetArray[i] =
+      (nameHash & UINT32_MAX) % maglevTable->tableSize;
+    maglevTable->skipArray[i] =
+      ((nameHash >> 32) % (maglevTable->tableSize - 1)) + 1;
+  }
+
+  populateMaglevTable(maglevTable, NULL);
+
+  return maglevTable;
+}
+
+static size_t getPermutationSlot(
+  const struct MaglevTable* maglevTable,
+  size_t backendIndex)
+{
+  return ((maglevTable->offsetArray[backendIndex] +
+           ((uint64_t)maglevTable->nextArray[backendIndex]) *
+           maglevTable->skipArray[backendIndex]) %
+          maglevTable->tableSize);
+}
+
+void populateMaglevTable(
+  struct MaglevTable* maglevTable,
+  const bool* eligibleArray)
+{
+  size_t numFilled = 0;
+  bool anyEligible = false;
+  size_t i;
+
+  assert(maglevTable != NULL);
+
+  for (i = 0; i < maglevTable->tableSize; ++i)
+  {
+    maglevTable->entryArray[i] = MAGLEV_NO_BACKEND;
+  }
+
+  for (i = 0; i < maglevTable->numBackends; ++i)
+  {
+    maglevTable->nextArray[i] = 0;
+    if ((eligibleArray == NULL) || eligibleArray[i])
+    {
+      anyEligible = true;
+    }
+  }
+
+  if (!anyEligible)
+  {
+    return;
+  }
+
+  while (true)
+  {
+    for (i = 0; i < maglevTable->numBackends; ++i)
+    {
+      size_t slot;
+
+      if ((eligibleArray != NULL) && (!eligibleArray[i]))
+      {
+        continue;
+      }
+
+      slot = getPermutationSlot(maglevTable, i);
+      while (maglevTable->entryArray[slot] != MAGLEV_NO_BACKEND)
+      {
+        ++(maglevTable->nextArray[i]);
+        slot = getPermutationSlot(maglevTable, i);
+      }
+
+      maglevTable->entryArray[slot] = i;
+      ++(maglevTable->nextArray[i]);
+
+      ++numFilled;
+      if (numFilled == maglevTable->tableSize)
+      {
+        return;
+      }
+    }
+  }
+}
+
+size_t lookupMaglevTable(
+  const struct MaglevTable* maglevTable,
+  uint64_t keyHash)
+{
+  assert(maglevTable != NULL);
+
+  return maglevTable->entryArray[keyHash % maglevTable->tableSize];
+}
@@ -0,0 +1,30 @@
+#ifndef MAGLEV_H
+#define MAGLEV_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Maglev consistent hashing lookup table.  Backends are identified by a
+   hash of a stable name, so the same name keeps most of its table slots
+   when other backends are added, removed or made ineligible. */
+struct MaglevTable;
+
+#define MAGLEV_NO_BACKEND (SIZE_MAX)
+
+struct MaglevTable* newMaglevTable(
+  const uint64_t* backendNameHashArray,
+  size_t numBackends);
+
+/* Refill the table from the backends with eligibleArray[i] set,
+   or from all backends if eligibleArray is NULL. */
+void populateMaglevTable(
+  struct MaglevTable* maglevTable,
+  const bool* eligibleArray);
+
+/* Returns MAGLEV_NO_BACKEND if no backend is eligible. */
+size_t lookupMaglevTable(
+  const struct MaglevTable* maglevTable,
+  uint64_t keyHash);
+
+#endif
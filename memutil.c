@@ -70,3 +70,52 @@ void* resizeDynamicArray(
     *capacity,
     memberSize);
 }
+
+#define DYNAMIC_ARRAY_USAGE_SAMPLES (256)
+#define MIN_SHRINK_CAPACITY (16)
+
+void* shrinkDynamicArray(
+  void* array,
+  const size_t length,
+  const size_t memberSize,
+  size_t* capacity,
+  struct DynamicArrayUsage* usage)
+{
+  size_t newCapacity;
+
+  assert(capacity != NULL);
+  assert(usage != NULL);
+
+  if (length > usage->highWaterMark)
+  {
+    usage->highWaterMark = length;
+  }
+
+  ++(usage->numSamples);
+  if (usage->numSamples < DYNAMIC_ARRAY_USAGE_SAMPLES)
+  {
+    return array;
+  }
+
+  newCapacity = (*capacity);
+  while ((newCapacity > MIN_SHRINK_CAPACITY) &&
+         ((usage->highWaterMark * 4) <= newCapacity))
+  {
+    newCapacity /= 2;
+  }
+
+  usage->highWaterMark = 0;
+  usage->numSamples = 0;
+
+  if (newCapacity == (*capacity))
+  {
+    return array;
+  }
+
+  (*capacity) = newCapacity;
+
+  return checkedReallocarray(
+    array,
+    *capacity,
+    memberSize);
+}
@@ -17,4 +17,20 @@ void* resizeDynamicArray(
   const size_t memberSize,
   size_t* capacity);
 
+struct DynamicArrayUsage
+{
+  size_t highWaterMark;
+  unsigned int numSamples;
+};
+
+/* Record that length members of a dynamic array are in use.  After enough
+   samples its capacity is halved, repeatedly, until the highest length
+   seen fills at least a quarter of it. */
+void* shrinkDynamicArray(
+  void* array,
+  const size_t length,
+  const size_t memberSize,
+  size_t* capacity,
+  struct DynamicArrayUsage* usage);
+
 #endif
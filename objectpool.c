@@ -0,0 +1,131 @@
+#include "objectpool.h"
+#include "memutil.h"
+#include <assert.h>
+#include <stdalign.h>
+#include <stddef.h>
+#include <string.h>
+
+#define MIN_SLAB_OBJECTS (64)
+
+struct ObjectPoolFreeObject
+{
+  struct ObjectPoolFreeObject* next;
+};
+
+struct ObjectPool
+{
+  size_t objectSize;
+  struct ObjectPoolFreeObject* freeList;
+  struct ObjectPoolStats stats;
+};
+
+static void addObjectPoolSlab(
+  struct ObjectPool* objectPool,
+  size_t numObjects)
+{
+  unsigned char* slab =
+    checkedReallocarray(NULL, numObjects, objectPool->objectSize);
+  size_t i;
+
+  for (i = numObjects; i > 0; --i)
+  {
+    struct ObjectPoolFreeObject* freeObject =
+      (struct ObjectPoolFreeObject*)(slab + ((i - 1) * objectPool->objectSize));
+    freeObject->next = objectPool->freeList;
+    objectPool->freeList = freeObject;
+  }
+
+  objectPool->stats.numFree += numObjects;
+  ++(objectPool->stats.numSlabs);
+}
+
+struct ObjectPool* newObjectPool(
+  size_t objectSize,
+  size_t initialObjects)
+{
+  struct ObjectPool* objectPool = checkedCallocOne(sizeof(struct ObjectPool));
+
+  /* every object must hold a free list link at max_align_t alignment */
+  if (objectSize < sizeof(struct ObjectPoolFreeObject))
+  {
+    objectSize = sizeof(struct ObjectPoolFreeObject);
+  }
+  objectSize = (objectSize + alignof(max_align_t) - 1) &
+               ~(alignof(max_align_t) - 1);
+  objectPool->objectSize = objectSize;
+
+  if (initialObjects > 0)
+  {
+    addObjectPoolSlab(objectPool, initialObjects);
+  }
+
+  return objectPool;
+}
+
+void* allocateUninitializedObjectPoolObject(
+  struct ObjectPool* objectPool)
+{
+  struct ObjectPoolFreeObject* freeObject;
+
+  assert(objectPool != NULL);
+
+  if (objectPool->freeList == NULL)
+  {
+    /* grow by half the objects in use so the number of slabs stays small */
+    size_t numObjects = objectPool->stats.numInUse / 2;
+    if (numObjects < MIN_SLAB_OBJECTS)
+    {
+      numObjects = MIN_SLAB_OBJECTS;
+    }
+    addObjectPoolSlab(objectPool, numObjects);
+  }
+
+  freeObject = objectPool->freeList;
+  objectPool->freeList = freeObject->next;
+
+  --(objectPool->stats.numFree);
+  ++(objectPool->stats.numInUse);
+  if (objectPool->stats.numInUse > objectPool->stats.maxInUse)
+  {
+    objectPool->stats.maxInUse = objectPool->stats.numInUse;
+  }
+
+  return freeObject;
+}
+
+void* allocateObjectPoolObject(
+  struct ObjectPool* objectPool)
+{
+  void* object = allocateUninitializedObjectPoolObject(objectPool);
+
+  memset(object, 0, objectPool->objectSize);
+  return object;
+}
+
+void freeObjectPoolObject(
+  struct ObjectPool* objectPool,
+  void* object)
+{
+  struct ObjectPoolFreeObject* freeObject = object;
+
+  assert(objectPool != NULL);
+
+  if (freeObject == NULL)
+  {
+    return;
+  }
+
+  freeObject->next = objectPool->freeList;
+  objectPool->freeList = freeObject;
+
+  ++(objectPool->stats.numFree);
+  --(objectPool->stats.numInUse);
+}
+
+const struct ObjectPoolStats* getObjectPoolStats(
+  const struct ObjectPool* objectPool)
+{
+  assert(objectPool != NULL);
+
+  return &(objectPool->stats);
+}
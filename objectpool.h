@@ -0,0 +1,38 @@
+#ifndef OBJECTPOOL_H
+#define OBJECTPOOL_H
+
+#include <stddef.h>
+
+/* Fixed size object allocator for a single thread.  Objects are carved
+   from slabs that are never returned to malloc, freed objects go on a
+   free list and are handed out again zeroed. */
+struct ObjectPool;
+
+struct ObjectPoolStats
+{
+  size_t numInUse;
+  size_t numFree;
+  size_t maxInUse;
+  size_t numSlabs;
+};
+
+struct ObjectPool* newObjectPool(
+  size_t objectSize,
+  size_t initialObjects);
+
+void* allocateObjectPoolObject(
+  struct ObjectPool* objectPool);
+
+/* Skips the zeroing, for objects like I/O buffers that are always written
+   before they are read. */
+void* allocateUninitializedObjectPoolObject(
+  struct ObjectPool* objectPool);
+
+void freeObjectPoolObject(
+  struct ObjectPool* objectPool,
+  void* object);
+
+const struct ObjectPoolStats* getObjectPoolStats(
+  const struct ObjectPool* objectPool);
+
+#endif
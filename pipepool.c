@@ -0,0 +1,131 @@
+#include "pipepool.h"
+#include "fdutil.h"
+#include "log.h"
+#include "errutil.h"
+#include "memutil.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+
+struct PipePool
+{
+  size_t pipeSize;
+  int* freeFDArray;
+  size_t freeFDArrayCapacity;
+  struct PipePoolStats stats;
+};
+
+static bool createPoolPipe(
+  const struct PipePool* pipePool,
+  int pipeFDArray[2])
+{
+  if (!createNonBlockingPipe(pipeFDArray))
+  {
+    return false;
+  }
+
+  /* a pipe that cannot grow still works, it just moves less per call */
+  setPipeSize(pipeFDArray[1], pipePool->pipeSize);
+
+  return true;
+}
+
+static void pushFreePipe(
+  struct PipePool* pipePool,
+  const int pipeFDArray[2])
+{
+  const size_t numFreeFDs = pipePool->stats.numFree * 2;
+
+  pipePool->freeFDArray =
+    resizeDynamicArray(
+      pipePool->freeFDArray,
+      numFreeFDs + 2,
+      sizeof(int),
+      &(pipePool->freeFDArrayCapacity));
+
+  pipePool->freeFDArray[numFreeFDs] = pipeFDArray[0];
+  pipePool->freeFDArray[numFreeFDs + 1] = pipeFDArray[1];
+  ++(pipePool->stats.numFree);
+}
+
+struct PipePool* newPipePool(
+  size_t pipeSize,
+  size_t initialPipes)
+{
+  struct PipePool* pipePool = checkedCallocOne(sizeof(struct PipePool));
+  size_t i;
+
+  pipePool->pipeSize = pipeSize;
+
+  for (i = 0; i < initialPipes; ++i)
+  {
+    int pipeFDArray[2];
+    if (!createPoolPipe(pipePool, pipeFDArray))
+    {
+      proxyLog("pipe pool pipe error errno %d: %s",
+               errno,
+               errnoToString(errno));
+      abort();
+    }
+    pushFreePipe(pipePool, pipeFDArray);
+  }
+
+  return pipePool;
+}
+
+bool takePipePoolPipe(
+  struct PipePool* pipePool,
+  int pipeFDArray[2])
+{
+  assert(pipePool != NULL);
+
+  if (pipePool->stats.numFree > 0)
+  {
+    const size_t numFreeFDs = --(pipePool->stats.numFree) * 2;
+    pipeFDArray[0] = pipePool->freeFDArray[numFreeFDs];
+    pipeFDArray[1] = pipePool->freeFDArray[numFreeFDs + 1];
+  }
+  else if (!createPoolPipe(pipePool, pipeFDArray))
+  {
+    return false;
+  }
+
+  ++(pipePool->stats.numInUse);
+  if (pipePool->stats.numInUse > pipePool->stats.maxInUse)
+  {
+    pipePool->stats.maxInUse = pipePool->stats.numInUse;
+  }
+
+  return true;
+}
+
+void returnPipePoolPipe(
+  struct PipePool* pipePool,
+  const int pipeFDArray[2])
+{
+  assert(pipePool != NULL);
+  assert(pipePool->stats.numInUse > 0);
+
+  --(pipePool->stats.numInUse);
+  pushFreePipe(pipePool, pipeFDArray);
+}
+
+void closePipePoolPipe(
+  struct PipePool* pipePool,
+  const int pipeFDArray[2])
+{
+  assert(pipePool != NULL);
+  assert(pipePool->stats.numInUse > 0);
+
+  --(pipePool->stats.numInUse);
+  signalSafeClose(pipeFDArray[0]);
+  signalSafeClose(pipeFDArray[1]);
+}
+
+const struct PipePoolStats* getPipePoolStats(
+  const struct PipePool* pipePool)
+{
+  assert(pipePool != NULL);
+
+  return &(pipePool->stats);
+}
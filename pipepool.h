@@ -0,0 +1,40 @@
+#ifndef PIPEPOOL_H
+#define PIPEPOOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Non-blocking pipes for splice(2) relays, for a single thread.  Pipes
+   are returned empty and handed out again as they are, so their fds are
+   only closed when a pipe that may still hold data is dropped. */
+struct PipePool;
+
+struct PipePoolStats
+{
+  size_t numInUse;
+  size_t numFree;
+  size_t maxInUse;
+};
+
+/* pipeSize is a request, pipes that cannot grow keep the default size. */
+struct PipePool* newPipePool(
+  size_t pipeSize,
+  size_t initialPipes);
+
+/* Returns false with errno set if a new pipe could not be created. */
+bool takePipePoolPipe(
+  struct PipePool* pipePool,
+  int pipeFDArray[2]);
+
+void returnPipePoolPipe(
+  struct PipePool* pipePool,
+  const int pipeFDArray[2]);
+
+void closePipePoolPipe(
+  struct PipePool* pipePool,
+  const int pipeFDArray[2]);
+
+const struct PipePoolStats* getPipePoolStats(
+  const struct PipePool* pipePool);
+
+#endif
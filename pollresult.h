@@ -5,26 +5,190 @@
 #include <stddef.h>
 #include <stdint.h>
 
+/*
+ * A ReadyEventInfo is the poll backend's own event structure, so the
+ * event loop dispatches straight from the array the kernel filled in.
+ * Expired timers are appended to the same array as synthesized events.
+ * The backend is chosen at build time, see POLL_BACKEND in the Makefile.
+ */
+
+#if defined(POLL_BACKEND_epoll)
+
+#include <sys/epoll.h>
+
+/* Read and write interest on one fd share a registration and its data.
+   epoll_event.data.ptr points to the registration, or to the timer data
+   for a timer event, which has no epoll event bits set. */
+struct EpollRegistration
+{
+  uint32_t events;
+  int fd;
+  void* data;
+};
+
 struct ReadyEventInfo
 {
-  uintptr_t id;
+  struct epoll_event epollEvent;
+};
+
+static inline bool isReadyEventForRead(
+  const struct ReadyEventInfo* readyEventInfo)
+{
+  const uint32_t events = readyEventInfo->epollEvent.events;
+  const struct EpollRegistration* registration;
+
+  if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) == 0)
+  {
+    return false;
+  }
+  registration = readyEventInfo->epollEvent.data.ptr;
+  return ((registration->events & EPOLLIN) != 0);
+}
+
+static inline bool isReadyEventForWrite(
+  const struct ReadyEventInfo* readyEventInfo)
+{
+  const uint32_t events = readyEventInfo->epollEvent.events;
+  const struct EpollRegistration* registration;
+
+  if ((events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) == 0)
+  {
+    return false;
+  }
+  registration = readyEventInfo->epollEvent.data.ptr;
+  return ((registration->events & EPOLLOUT) != 0);
+}
+
+static inline bool isReadyEventForTimeout(
+  const struct ReadyEventInfo* readyEventInfo)
+{
+  return (readyEventInfo->epollEvent.events == 0);
+}
+
+static inline void* getReadyEventData(
+  const struct ReadyEventInfo* readyEventInfo)
+{
+  const struct EpollRegistration* registration;
+
+  if (isReadyEventForTimeout(readyEventInfo))
+  {
+    return readyEventInfo->epollEvent.data.ptr;
+  }
+  registration = readyEventInfo->epollEvent.data.ptr;
+  return registration->data;
+}
+
+#elif defined(POLL_BACKEND_iouring)
+
+#include <poll.h>
+
+/* Read and write interest on one fd share a registration and its data,
+   watched by at most one poll request in flight on the ring.  A ready
+   event points to the registration, or to the timer data for a timer
+   event, which has no poll event bits set. */
+struct IOUringRegistration
+{
+  uint32_t events;
+  int fd;
   void* data;
-  bool readyForRead;
-  bool readyForWrite;
-  bool readyForTimeout;
+  bool changed;
+  bool armed;
+  uint32_t armedEvents;
+  uint32_t generation;
+  uint64_t armedUserData;
 };
 
-struct PollResult
+struct ReadyEventInfo
 {
-  size_t numReadyEvents;
-  struct ReadyEventInfo* readyEventInfoArray;
-  size_t arrayCapacity;
+  uint32_t events;
+  void* ptr;
+};
+
+static inline bool isReadyEventForRead(
+  const struct ReadyEventInfo* readyEventInfo)
+{
+  const struct IOUringRegistration* registration;
+
+  if ((readyEventInfo->events & (POLLIN | POLLHUP | POLLERR)) == 0)
+  {
+    return false;
+  }
+  registration = readyEventInfo->ptr;
+  return ((registration->events & POLLIN) != 0);
+}
+
+static inline bool isReadyEventForWrite(
+  const struct ReadyEventInfo* readyEventInfo)
+{
+  const struct IOUringRegistration* registration;
+
+  if ((readyEventInfo->events & (POLLOUT | POLLHUP | POLLERR)) == 0)
+  {
+    return false;
+  }
+  registration = readyEventInfo->ptr;
+  return ((registration->events & POLLOUT) != 0);
+}
+
+static inline bool isReadyEventForTimeout(
+  const struct ReadyEventInfo* readyEventInfo)
+{
+  return (readyEventInfo->events == 0);
+}
+
+static inline void* getReadyEventData(
+  const struct ReadyEventInfo* readyEventInfo)
+{
+  const struct IOUringRegistration* registration;
+
+  if (isReadyEventForTimeout(readyEventInfo))
+  {
+    return readyEventInfo->ptr;
+  }
+  registration = readyEventInfo->ptr;
+  return registration->data;
+}
+
+#else
+
+#include <sys/types.h>
+#include <sys/event.h>
+
+struct ReadyEventInfo
+{
+  struct kevent kevent;
 };
 
-struct PollResult* newPollResult();
+static inline bool isReadyEventForRead(
+  const struct ReadyEventInfo* readyEventInfo)
+{
+  return (readyEventInfo->kevent.filter == EVFILT_READ);
+}
+
+static inline bool isReadyEventForWrite(
+  const struct ReadyEventInfo* readyEventInfo)
+{
+  return (readyEventInfo->kevent.filter == EVFILT_WRITE);
+}
+
+static inline bool isReadyEventForTimeout(
+  const struct ReadyEventInfo* readyEventInfo)
+{
+  return (readyEventInfo->kevent.filter == EVFILT_TIMER);
+}
+
+static inline void* getReadyEventData(
+  const struct ReadyEventInfo* readyEventInfo)
+{
+  return readyEventInfo->kevent.udata;
+}
+
+#endif
 
-void setPollResultNumReadyEvents(
-  struct PollResult* pollResult,
-  size_t numReadyEvents);
+struct PollResult
+{
+  size_t numReadyEvents;
+  const struct ReadyEventInfo* readyEventInfoArray;
+};
 
 #endif
@@ -0,0 +1,159 @@
+#include "polltimer.h"
+#include "timeutil.h"
+#include <assert.h>
+
+/*
+ * Timers shared by the PollState backends.  They live in a userspace
+ * timer wheel, the kernel only sees the wait timeout of blockingPoll().
+ * Expired timers the backend has not reported yet stay on the expired
+ * list and make the next wait return immediately.
+ */
+
+void initPollTimers(
+  struct PollTimers* pollTimers)
+{
+  assert(pollTimers != NULL);
+
+  pollTimers->timerWheel = newTimerWheel(getMonotonicTimeMS());
+  TAILQ_INIT(&(pollTimers->expiredList));
+  pollTimers->numExpired = 0;
+}
+
+size_t getNumPollTimers(
+  const struct PollTimers* pollTimers)
+{
+  assert(pollTimers != NULL);
+
+  return (getTimerWheelNumEntries(pollTimers->timerWheel) +
+          pollTimers->numExpired);
+}
+
+void startPollTimer(
+  struct PollTimers* pollTimers,
+  struct PollTimer* pollTimer,
+  uintptr_t id,
+  void* data,
+  uint32_t timeoutMilliseconds,
+  uint32_t periodMilliseconds)
+{
+  assert(pollTimers != NULL);
+  assert(pollTimer != NULL);
+
+  stopPollTimer(pollTimers, pollTimer);
+
+  pollTimer->id = id;
+  pollTimer->data = data;
+  pollTimer->periodMilliseconds = periodMilliseconds;
+
+  addTimerWheelEntry(
+    pollTimers->timerWheel,
+    &(pollTimer->timerWheelEntry),
+    getMonotonicTimeMS() + timeoutMilliseconds);
+}
+
+void stopPollTimer(
+  struct PollTimers* pollTimers,
+  struct PollTimer* pollTimer)
+{
+  assert(pollTimers != NULL);
+  assert(pollTimer != NULL);
+
+  if (pollTimer->expired)
+  {
+    TAILQ_REMOVE(&(pollTimers->expiredList),
+                 &(pollTimer->timerWheelEntry), entry);
+    pollTimer->expired = false;
+    --(pollTimers->numExpired);
+  }
+  else
+  {
+    removeTimerWheelEntry(pollTimers->timerWheel,
+                          &(pollTimer->timerWheelEntry));
+  }
+}
+
+bool isPollTimerActive(
+  const struct PollTimer* pollTimer)
+{
+  assert(pollTimer != NULL);
+
+  return (pollTimer->timerWheelEntry.pending ||
+          pollTimer->expired);
+}
+
+int getPollTimerWaitMilliseconds(
+  const struct PollTimers* pollTimers)
+{
+  assert(pollTimers != NULL);
+
+  if (pollTimers->numExpired > 0)
+  {
+    return 0;
+  }
+
+  return getTimerWheelTimeoutMS(pollTimers->timerWheel, getMonotonicTimeMS());
+}
+
+size_t expirePollTimers(
+  struct PollTimers* pollTimers)
+{
+  struct TimerWheelEntryList newlyExpiredList;
+  struct TimerWheelEntry* timerWheelEntry;
+
+  assert(pollTimers != NULL);
+
+  TAILQ_INIT(&newlyExpiredList);
+
+  expireTimerWheelEntries(
+    pollTimers->timerWheel, getMonotonicTimeMS(), &newlyExpiredList);
+
+  /* appended so timers left over from a capped batch go out first */
+  while ((timerWheelEntry = TAILQ_FIRST(&newlyExpiredList)) != NULL)
+  {
+    struct PollTimer* pollTimer = (struct PollTimer*)timerWheelEntry;
+
+    TAILQ_REMOVE(&newlyExpiredList, timerWheelEntry, entry);
+    TAILQ_INSERT_TAIL(&(pollTimers->expiredList), timerWheelEntry, entry);
+    pollTimer->expired = true;
+    ++(pollTimers->numExpired);
+  }
+
+  return pollTimers->numExpired;
+}
+
+const struct PollTimer* popExpiredPollTimer(
+  struct PollTimers* pollTimers)
+{
+  struct TimerWheelEntry* timerWheelEntry;
+  struct PollTimer* pollTimer;
+
+  assert(pollTimers != NULL);
+
+  timerWheelEntry = TAILQ_FIRST(&(pollTimers->expiredList));
+  if (timerWheelEntry == NULL)
+  {
+    return NULL;
+  }
+
+  pollTimer = (struct PollTimer*)timerWheelEntry;
+
+  TAILQ_REMOVE(&(pollTimers->expiredList), timerWheelEntry, entry);
+  pollTimer->expired = false;
+  --(pollTimers->numExpired);
+
+  if (pollTimer->periodMilliseconds > 0)
+  {
+    /* rearm from the previous deadline so the period does not drift,
+       unless the loop fell a whole period behind */
+    const uint64_t nowMS = getMonotonicTimeMS();
+    uint64_t expireTimeMS =
+      timerWheelEntry->expireTimeMS + pollTimer->periodMilliseconds;
+    if (expireTimeMS <= nowMS)
+    {
+      expireTimeMS = nowMS + pollTimer->periodMilliseconds;
+    }
+    addTimerWheelEntry(pollTimers->timerWheel, timerWheelEntry, expireTimeMS);
+  }
+
+  return pollTimer;
+}
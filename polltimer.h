@@ -0,0 +1,61 @@
+#ifndef POLLTIMER_H
+#define POLLTIMER_H
+
+#include "timerwheel.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+struct PollTimer
+{
+  struct TimerWheelEntry timerWheelEntry;
+  uintptr_t id;
+  void* data;
+  uint32_t periodMilliseconds;
+  bool expired;
+};
+
+/* Timers waiting in the wheel plus expired timers not yet reported. */
+struct PollTimers
+{
+  struct TimerWheel* timerWheel;
+  struct TimerWheelEntryList expiredList;
+  size_t numExpired;
+};
+
+void initPollTimers(
+  struct PollTimers* pollTimers);
+
+size_t getNumPollTimers(
+  const struct PollTimers* pollTimers);
+
+void startPollTimer(
+  struct PollTimers* pollTimers,
+  struct PollTimer* pollTimer,
+  uintptr_t id,
+  void* data,
+  uint32_t timeoutMilliseconds,
+  uint32_t periodMilliseconds);
+
+void stopPollTimer(
+  struct PollTimers* pollTimers,
+  struct PollTimer* pollTimer);
+
+/* True from startPollTimer() until the timer is stopped or, for a one
+   shot timer, reported.  A reported timeout whose timer is active again
+   was queued before the timer was restarted. */
+bool isPollTimerActive(
+  const struct PollTimer* pollTimer);
+
+int getPollTimerWaitMilliseconds(
+  const struct PollTimers* pollTimers);
+
+/* Returns the number of expired timers waiting to be reported. */
+size_t expirePollTimers(
+  struct PollTimers* pollTimers);
+
+/* Takes the next expired timer to report, periodic timers are rearmed.
+   Returns NULL when no expired timers are left. */
+const struct PollTimer* popExpiredPollTimer(
+  struct PollTimers* pollTimers);
+
+#endif
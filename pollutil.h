@@ -2,11 +2,16 @@
 #define POLLUTIL_H
 
 #include "pollresult.h"
+#include "polltimer.h"
+#include <stddef.h>
 #include <stdint.h>
 
 struct PollState;
 
-struct PollState* newPollState();
+/* blockingPoll() returns at most maxEventsPerWait fd events and
+   maxEventsPerWait timer events per call. */
+struct PollState* newPollState(
+  size_t maxEventsPerWait);
 
 void addPollFDForRead(
   struct PollState* pollState,
@@ -17,22 +22,40 @@ void removePollFDForRead(
   struct PollState* pollState,
   uintptr_t fd);
 
-void addPollFDForWriteAndTimeout(
+void addPollFDForWrite(
   struct PollState* pollState,
   uintptr_t fd,
-  void* data,
-  uint32_t timeoutMillseconds);
+  void* data);
 
-void removePollFDForWriteAndTimeout(
+void removePollFDForWrite(
   struct PollState* pollState,
   uintptr_t fd);
 
+/* One shot timeout reported as readyForTimeout with id and data.
+   pollTimer is owned by the caller and may be removed at any time. */
+void addPollTimer(
+  struct PollState* pollState,
+  struct PollTimer* pollTimer,
+  uintptr_t id,
+  void* data,
+  uint32_t timeoutMilliseconds);
+
+void removePollTimer(
+  struct PollState* pollState,
+  struct PollTimer* pollTimer);
+
 void addPollIDForPeriodicTimer(
   struct PollState* pollState,
   uintptr_t id,
   void* data,
   uint32_t periodMilliseconds);
 
+/* Registration changes may be deferred until the next blockingPoll().
+   flushPollState() hands them to the kernel immediately, and must be
+   called before closing an fd whose registrations were just removed. */
+void flushPollState(
+  struct PollState* pollState);
+
 const struct PollResult* blockingPoll(
   struct PollState* pollState);
 
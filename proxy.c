@@ -1,14 +1,24 @@
 #include "errutil.h"
 #include "fdutil.h"
+#include "histogram.h"
 #include "log.h"
 #include "memutil.h"
+#include "objectpool.h"
+#include "pipepool.h"
 #include "pollutil.h"
 #include "proxysettings.h"
+#include "remoteselector.h"
 #include "socketutil.h"
+#include "spscring.h"
+#include "timeutil.h"
+#include "tokenbucket.h"
 #include <errno.h>
+#include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -20,16 +30,93 @@
 
 #define PERIODIC_TIMER_ID (UINTPTR_MAX)
 
+#define HEALTH_CHECK_TIMER_ID (UINTPTR_MAX - 1)
+
+#define REMOTE_EJECTION_TIMER_ID (UINTPTR_MAX - 2)
+
+#define RACE_CONNECT_TIMER_ID (UINTPTR_MAX - 3)
+
+#define WARM_CONNECTION_TIMER_ID (UINTPTR_MAX - 4)
+
+#define WARM_CONNECTION_RETRY_MS (1000)
+
+#define PENDING_CLIENT_TIMER_ID (UINTPTR_MAX - 5)
+
+#define RATE_LIMIT_TIMER_ID (UINTPTR_MAX - 6)
+
+#define RATE_LIMIT_REFILL_MS (100)
+
+#define HANDOFF_QUEUE_CAPACITY (1024)
+
+#define RELAY_BUFFER_SIZE (16 * 1024)
+
+#define RELAY_PIPE_SIZE (256 * 1024)
+
 struct ConnectionSocketInfo;
 
 TAILQ_HEAD(ConnectionSocketInfoList, ConnectionSocketInfo);
 
+struct HandoffQueueInfo;
+
+struct RemoteEjectionInfo;
+
+struct WarmConnectionInfo;
+
+struct PendingClientQueueInfo;
+
+struct RateLimitInfo;
+
+enum LoopPhase
+{
+  LOOP_PHASE_WAIT,
+  LOOP_PHASE_HANDLERS,
+  LOOP_PHASE_DESTROY,
+  NUM_LOOP_PHASES
+};
+
+enum ReadyEventHandlerType
+{
+  SERVER_SOCKET_HANDLER,
+  CONNECTION_SOCKET_HANDLER,
+  HANDOFF_QUEUE_HANDLER,
+  PERIODIC_TIMER_HANDLER,
+  HEALTH_CHECK_HANDLER,
+  REMOTE_EJECTION_HANDLER,
+  RACE_CONNECT_HANDLER,
+  WARM_CONNECTION_HANDLER,
+  PENDING_CLIENT_HANDLER,
+  RATE_LIMIT_HANDLER,
+  NUM_READY_EVENT_HANDLER_TYPES
+};
+
+/* Microsecond histograms since the last periodic log. */
+struct LoopStats
+{
+  struct Log2Histogram phaseHistogramArray[NUM_LOOP_PHASES];
+  struct Log2Histogram handlerHistogramArray[NUM_READY_EVENT_HANDLER_TYPES];
+  struct Log2Histogram eventsPerWaitHistogram;
+};
+
 struct ProxyContext
 {
   const struct ProxySettings* proxySettings;
+  uint32_t threadIndex;
   struct PollState* pollState;
   struct ConnectionSocketInfoList* activeList;
   struct ConnectionSocketInfoList* destroyedList;
+  atomic_size_t numSessions;
+  struct HandoffQueueInfo* handoffQueueInfo;
+  struct ProxyContext** workerContextArray;
+  uint32_t numWorkerContexts;
+  struct LoopStats* loopStats;
+  struct ObjectPool* connectionPairPool;
+  struct ObjectPool* relayBufferPool;
+  struct PipePool* relayPipePool;
+  struct RemoteSelector* remoteSelector;
+  struct RemoteEjectionInfo* remoteEjectionInfoArray;
+  struct WarmConnectionInfo* warmConnectionInfoArray;
+  struct PendingClientQueueInfo* pendingClientQueueInfo;
+  struct RateLimitInfo* rateLimitInfo;
 };
 
 struct AbstractReadyEventHandler;
@@ -54,10 +141,18 @@ static void handlePeriodicTimerReady(
   const struct ReadyEventInfo* readyEventInfo,
   struct ProxyContext* proxyContext);
 
+typedef void (*HandleClientSocketFunction)(
+  const int clientSocket,
+  const struct SockAddrInfo* clientSockAddrInfo,
+  const struct ListenAddrInfo* listenAddrInfo,
+  struct ProxyContext* proxyContext);
+
 struct ServerSocketInfo
 {
   HandleReadyEventFunction handleReadyEventFunction;
   int socket;
+  const struct ListenAddrInfo* listenAddrInfo;
+  HandleClientSocketFunction handleClientSocketFunction;
 };
 
 static void handleServerSocketReady(
@@ -65,12 +160,182 @@ static void handleServerSocketReady(
   const struct ReadyEventInfo* readyEventInfo,
   struct ProxyContext* proxyContext);
 
+struct HandoffSocketInfo
+{
+  int socket;
+  struct SockAddrInfo clientSockAddrInfo;
+  const struct ListenAddrInfo* listenAddrInfo;
+};
+
+struct HandoffQueueInfo
+{
+  HandleReadyEventFunction handleReadyEventFunction;
+  int wakeupReadFD;
+  int wakeupWriteFD;
+  atomic_bool wakeupPending;
+  struct SPSCRing* spscRing;
+};
+
+static void handleHandoffQueueReady(
+  struct AbstractReadyEventHandler* abstractReadyEventHandler,
+  const struct ReadyEventInfo* readyEventInfo,
+  struct ProxyContext* proxyContext);
+
+/*
+ * Each event loop thread probes every remote with a non-blocking TCP
+ * connect once per health check interval, and a probe still connecting
+ * when the next interval starts has failed.  healthCheckRise good probes
+ * in a row mark a remote healthy, healthCheckFall failed probes unhealthy.
+ */
+struct HealthCheckInfo
+{
+  HandleReadyEventFunction handleReadyEventFunction;
+  size_t remoteIndex;
+  int socket;
+  uint32_t numGoodProbes;
+  uint32_t numFailedProbes;
+};
+
+static void handleHealthCheckReady(
+  struct AbstractReadyEventHandler* abstractReadyEventHandler,
+  const struct ReadyEventInfo* readyEventInfo,
+  struct ProxyContext* proxyContext);
+
+/* Ends an outlier ejection of one remote when its timer fires. */
+struct RemoteEjectionInfo
+{
+  HandleReadyEventFunction handleReadyEventFunction;
+  size_t remoteIndex;
+  struct PollTimer ejectionTimer;
+};
+
+static void handleRemoteEjectionReady(
+  struct AbstractReadyEventHandler* abstractReadyEventHandler,
+  const struct ReadyEventInfo* readyEventInfo,
+  struct ProxyContext* proxyContext);
+
+/*
+ * With -w each event loop thread keeps warmConnections slots per remote,
+ * each holding a connect in progress or an idle connected socket that a
+ * new client can be spliced to right away.  A slot is refilled as soon
+ * as its socket is taken or closed.  The slot timer is the connect
+ * timeout while connecting, the idle limit once connected, and the retry
+ * delay after a failed connect.
+ */
+enum WarmConnectionState
+{
+  WARM_CONNECTION_EMPTY,
+  WARM_CONNECTION_CONNECTING,
+  WARM_CONNECTION_IDLE
+};
+
+struct WarmConnectionInfo
+{
+  HandleReadyEventFunction handleReadyEventFunction;
+  size_t remoteIndex;
+  int socket;
+  enum WarmConnectionState state;
+  uint64_t connectStartTimeUS;
+  struct PollTimer timer;
+};
+
+static void handleWarmConnectionReady(
+  struct AbstractReadyEventHandler* abstractReadyEventHandler,
+  const struct ReadyEventInfo* readyEventInfo,
+  struct ProxyContext* proxyContext);
+
+/*
+ * Clients accepted while every remote is at its max sessions wait here
+ * in arrival order, up to pendingClients of them.  Each gets a session
+ * when one ends, or is closed after pendingClientMS.  With a single
+ * deadline per client the oldest always expires first, so one timer for
+ * the head of the queue covers them all.
+ */
+struct PendingClientInfo
+{
+  int socket;
+  struct SockAddrInfo clientSockAddrInfo;
+  const struct ListenAddrInfo* listenAddrInfo;
+  uint64_t deadlineMS;
+};
+
+struct PendingClientQueueInfo
+{
+  HandleReadyEventFunction handleReadyEventFunction;
+  struct PendingClientInfo* pendingClientArray;
+  size_t capacity;
+  size_t headIndex;
+  size_t numPendingClients;
+  struct PollTimer deadlineTimer;
+};
+
+static void handlePendingClientQueueReady(
+  struct AbstractReadyEventHandler* abstractReadyEventHandler,
+  const struct ReadyEventInfo* readyEventInfo,
+  struct ProxyContext* proxyContext);
+
+/*
+ * With -v every socket of a session has a token bucket for the bytes read
+ * from it.  Each listen address with a byte rate has a pair of buckets per
+ * thread, for the bytes read from its clients and from their remotes,
+ * shared by all of its sessions there.  A socket whose buckets are empty
+ * stops waiting for read and is marked rateLimited.  The refill timer
+ * refills every bucket and resumes reading on the paused sockets, the next
+ * read readiness does the I/O.
+ */
+struct ListenRateLimit
+{
+  struct TokenBucket clientTokenBucket;
+  struct TokenBucket remoteTokenBucket;
+  uint32_t numSessions;
+};
+
+struct RateLimitInfo
+{
+  HandleReadyEventFunction handleReadyEventFunction;
+  struct ListenRateLimit* listenRateLimitArray;
+};
+
+static void handleRateLimitReady(
+  struct AbstractReadyEventHandler* abstractReadyEventHandler,
+  const struct ReadyEventInfo* readyEventInfo,
+  struct ProxyContext* proxyContext);
+
 enum ConnectionSocketInfoType
 {
   CLIENT_TO_PROXY,
   PROXY_TO_REMOTE
 };
 
+/*
+ * With -z copy, data read from a socket is written to the related socket
+ * through a buffer from the thread's relay buffer pool.  Whatever the
+ * related socket does not take right away stays in the buffer: reading
+ * pauses and the related socket waits for write until the buffer is
+ * empty.  An empty buffer goes straight back to the pool, so buffers are
+ * only held by directions with data in flight.
+ *
+ * -z pipe works the same way with a pipe from the thread's relay pipe
+ * pool in place of the buffer, moving data with splice(2) so it never
+ * reaches userspace.
+ *
+ * In every relay mode readFinished is set once the socket's peer has
+ * sent its FIN and the FIN was passed on to the related socket.  The
+ * session lasts until both sockets have finished reading.
+ *
+ * With rate limits SO_SPLICE is set up one direction at a time, when the
+ * socket becomes readable, with the bytes its buckets allow as the splice
+ * maximum.  spliceActive is set while such a splice is in place.  Tokens
+ * are taken for the bytes it has moved, spliceBytesCharged of them so
+ * far, and those bytes are added to bytesRelayed once it dissolves.
+ */
+struct RelayBuffer
+{
+  size_t startOffset;
+  size_t endOffset;
+  unsigned char data[RELAY_BUFFER_SIZE];
+};
+
 struct ConnectionSocketInfo
 {
   HandleReadyEventFunction handleReadyEventFunction;
@@ -79,12 +344,287 @@ struct ConnectionSocketInfo
   bool markedForDestruction;
   bool waitingForConnect;
   bool waitingForRead;
+  bool waitingForWrite;
+  bool readFinished;
+  bool rateLimited;
+  bool spliceActive;
+  off_t spliceBytesCharged;
   struct ConnectionSocketInfo* relatedConnectionSocketInfo;
-  struct AddrPortStrings clientAddrPortStrings;
-  struct AddrPortStrings serverAddrPortStrings;
+  struct RelayBuffer* relayBuffer;
+  bool holdingRelayPipe;
+  int relayPipeFDArray[2];
+  size_t relayPipeBytes;
+  off_t bytesRelayed;
+  struct TokenBucket tokenBucket;
+  struct TokenBucket* listenTokenBucket;
+  struct PollTimer connectTimer;
   TAILQ_ENTRY(ConnectionSocketInfo) entry;
 };
 
+/*
+ * Second connect for -y, started to another remote when the remote half
+ * has not connected after raceConnectDelayMS.  Whichever connects first
+ * becomes the remote half and the other socket is closed.  The race has
+ * no timeout of its own, if the remote half fails first the race takes
+ * its place and gets the connect timeout.
+ */
+struct RaceConnectInfo
+{
+  HandleReadyEventFunction handleReadyEventFunction;
+  int socket;
+  bool waitingForDelay;
+  const struct RemoteAddrInfo* remoteAddrInfo;
+  uint64_t connectStartTimeUS;
+  struct PollTimer delayTimer;
+};
+
+static void handleRaceConnectReady(
+  struct AbstractReadyEventHandler* abstractReadyEventHandler,
+  const struct ReadyEventInfo* readyEventInfo,
+  struct ProxyContext* proxyContext);
+
+/*
+ * Both halves of a session come from the worker's pool in one object,
+ * which is returned when the second half is destroyed.  Only the client
+ * address and the chosen remote are kept, everything else in a log line
+ * is looked up when the line is written.
+ */
+struct ConnectionPair
+{
+  struct ConnectionSocketInfo clientConnectionSocketInfo;
+  struct ConnectionSocketInfo remoteConnectionSocketInfo;
+  struct CompactSockAddr clientSockAddr;
+  const struct RemoteAddrInfo* remoteAddrInfo;
+  struct ListenRateLimit* listenRateLimit;
+  uint64_t connectStartTimeUS;
+  uint32_t numConnectRetries;
+  struct RaceConnectInfo raceConnectInfo;
+};
+
+static struct ConnectionPair* getConnectionPair(
+  const struct ConnectionSocketInfo* connectionSocketInfo)
+{
+  if (connectionSocketInfo->type == CLIENT_TO_PROXY)
+  {
+    return (struct ConnectionPair*)connectionSocketInfo;
+  }
+  return (struct ConnectionPair*)
+    (((char*)connectionSocketInfo) -
+     offsetof(struct ConnectionPair, remoteConnectionSocketInfo));
+}
+
+/* Unlike relatedConnectionSocketInfo this stays set while the pair is
+   being destroyed. */
+static const struct ConnectionSocketInfo* getPairedConnectionSocketInfo(
+  const struct ConnectionSocketInfo* connectionSocketInfo)
+{
+  const struct ConnectionPair* connectionPair =
+    getConnectionPair(connectionSocketInfo);
+
+  if (connectionSocketInfo->type == CLIENT_TO_PROXY)
+  {
+    return &(connectionPair->remoteConnectionSocketInfo);
+  }
+  return &(connectionPair->clientConnectionSocketInfo);
+}
+
+static struct ConnectionPair* getRaceConnectionPair(
+  const struct RaceConnectInfo* raceConnectInfo)
+{
+  return (struct ConnectionPair*)
+    (((char*)raceConnectInfo) -
+     offsetof(struct ConnectionPair, raceConnectInfo));
+}
+
+static size_t getRemoteAddrInfoIndex(
+  const struct ProxyContext* proxyContext,
+  const struct ConnectionPair* connectionPair)
+{
+  return (connectionPair->remoteAddrInfo -
+          proxyContext->proxySettings->remoteAddrInfoArray);
+}
+
+static void startRemoteEjection(
+  struct ProxyContext* proxyContext,
+  size_t remoteIndex,
+  uint32_t ejectionMS)
+{
+  const struct RemoteAddrInfo* remoteAddrInfo =
+    proxyContext->proxySettings->remoteAddrInfoArray + remoteIndex;
+  struct RemoteEjectionInfo* remoteEjectionInfo =
+    proxyContext->remoteEjectionInfoArray + remoteIndex;
+
+  proxyLog("remote %s:%s ejected for %ums after %u connect failures "
+           "(thread=%u)",
+           remoteAddrInfo->addrPortStrings.addrString,
+           remoteAddrInfo->addrPortStrings.portString,
+           ejectionMS,
+           proxyContext->proxySettings->outlierConnectFailures,
+           proxyContext->threadIndex);
+
+  addPollTimer(
+    proxyContext->pollState,
+    &(remoteEjectionInfo->ejectionTimer),
+    REMOTE_EJECTION_TIMER_ID,
+    remoteEjectionInfo,
+    ejectionMS);
+}
+
+/* Feeds the remote's connect time average used by -b p2c and its outlier
+   ejection.  A failed connect counts as taking the full connect timeout. */
+static void addRemoteConnectResultSample(
+  struct ProxyContext* proxyContext,
+  size_t remoteIndex,
+  uint64_t connectStartTimeUS,
+  bool connected)
+{
+  const uint64_t connectTimeoutUS =
+    ((uint64_t)proxyContext->proxySettings->connectTimeoutMS) * 1000;
+  uint64_t connectTimeUS = getMonotonicTimeUS() - connectStartTimeUS;
+  uint32_t ejectionMS;
+
+  if ((!connected) && (connectTimeUS < connectTimeoutUS))
+  {
+    connectTimeUS = connectTimeoutUS;
+  }
+
+  addRemoteConnectTime(proxyContext->remoteSelector,
+                       remoteIndex,
+                       connectTimeUS);
+
+  ejectionMS = addRemoteConnectResult(proxyContext->remoteSelector,
+                                      remoteIndex,
+                                      connected);
+  if (ejectionMS > 0)
+  {
+    startRemoteEjection(proxyContext, remoteIndex, ejectionMS);
+  }
+}
+
+static void addConnectResult(
+  struct ProxyContext* proxyContext,
+  const struct ConnectionSocketInfo* connectionSocketInfo,
+  bool connected)
+{
+  const struct ConnectionPair* connectionPair =
+    getConnectionPair(connectionSocketInfo);
+
+  addRemoteConnectResultSample(
+    proxyContext,
+    getRemoteAddrInfoIndex(proxyContext, connectionPair),
+    connectionPair->connectStartTimeUS,
+    connected);
+}
+
+/* Bytes moved from this socket to the related one. */
+static off_t getBytesTransferred(
+  const struct ProxyContext* proxyContext,
+  const struct ConnectionSocketInfo* connectionSocketInfo)
+{
+  if ((proxyContext->proxySettings->relayMode == RELAY_SO_SPLICE) &&
+      (proxyContext->rateLimitInfo == NULL))
+  {
+    return getSpliceBytesTransferred(connectionSocketInfo->socket);
+  }
+  else if (connectionSocketInfo->spliceActive)
+  {
+    return (connectionSocketInfo->bytesRelayed +
+            getSpliceBytesTransferred(connectionSocketInfo->socket));
+  }
+  return connectionSocketInfo->bytesRelayed;
+}
+
+/* SO_SPLICE hands both directions to the kernel once the remote is
+   connected, unless rate limits splice them on readiness.  The copy
+   relay needs no setup, it starts on readiness.  splice(2) only honours
+   O_NONBLOCK, which accepted sockets may lack. */
+static bool setupRelay(
+  const struct ProxyContext* proxyContext,
+  const int socket1,
+  const int socket2)
+{
+  if ((proxyContext->proxySettings->relayMode == RELAY_SO_SPLICE) &&
+      (proxyContext->rateLimitInfo == NULL))
+  {
+    return setBidirectionalSplice(socket1, socket2);
+  }
+  else if (proxyContext->proxySettings->relayMode == RELAY_PIPE)
+  {
+    return (setFDNonBlocking(socket1) &&
+            setFDNonBlocking(socket2));
+  }
+  return true;
+}
+
+static void setUnknownAddrPortStrings(
+  struct AddrPortStrings* addrPortStrings)
+{
+  snprintf(addrPortStrings->addrString, MAX_ADDR_STRING_LENGTH, "?");
+  snprintf(addrPortStrings->portString, MAX_PORT_STRING_LENGTH, "?");
+}
+
+static void getSocketNameAddrPortStrings(
+  const int socket,
+  struct AddrPortStrings* addrPortStrings)
+{
+  struct SockAddrInfo sockAddrInfo;
+
+  if ((!getSocketName(socket, &sockAddrInfo)) ||
+      (!sockAddrInfoToNameAndPort(&sockAddrInfo, addrPortStrings)))
+  {
+    setUnknownAddrPortStrings(addrPortStrings);
+  }
+}
+
+/* client is the connecting side of the socket, server the accepting side */
+static void getConnectionAddrPortStrings(
+  const struct ConnectionSocketInfo* connectionSocketInfo,
+  struct AddrPortStrings* clientAddrPortStrings,
+  struct AddrPortStrings* serverAddrPortStrings)
+{
+  const struct ConnectionPair* connectionPair =
+    getConnectionPair(connectionSocketInfo);
+
+  if (connectionSocketInfo->type == CLIENT_TO_PROXY)
+  {
+    if (!compactSockAddrToNameAndPort(&(connectionPair->clientSockAddr),
+                                      clientAddrPortStrings))
+    {
+      setUnknownAddrPortStrings(clientAddrPortStrings);
+    }
+    getSocketNameAddrPortStrings(connectionSocketInfo->socket,
+                                 serverAddrPortStrings);
+  }
+  else
+  {
+    getSocketNameAddrPortStrings(connectionSocketInfo->socket,
+                                 clientAddrPortStrings);
+    memcpy(serverAddrPortStrings,
+           &(connectionPair->remoteAddrInfo->addrPortStrings),
+           sizeof(struct AddrPortStrings));
+  }
+}
+
+static void printConnectMessage(
+  const char* messagePrefix,
+  const struct ConnectionSocketInfo* connectionSocketInfo)
+{
+  struct AddrPortStrings clientAddrPortStrings;
+  struct AddrPortStrings serverAddrPortStrings;
+
+  getConnectionAddrPortStrings(connectionSocketInfo,
+                               &clientAddrPortStrings,
+                               &serverAddrPortStrings);
+
+  proxyLog("%s %s:%s -> %s:%s (fd=%d)",
+           messagePrefix,
+           clientAddrPortStrings.addrString,
+           clientAddrPortStrings.portString,
+           serverAddrPortStrings.addrString,
+           serverAddrPortStrings.portString,
+           connectionSocketInfo->socket);
+}
+
 static struct ConnectionSocketInfoList* newTAILQ()
 {
   struct ConnectionSocketInfoList* retVal =
@@ -123,8 +663,11 @@ static void handleConnectionSocketReady(
   const struct ReadyEventInfo* readyEventInfo,
   struct ProxyContext* proxyContext);
 
-static void setupServerSockets(struct ProxyContext* proxyContext)
+static void setupServerSockets(
+  struct ProxyContext* proxyContext,
+  HandleClientSocketFunction handleClientSocketFunction)
 {
+  const struct ProxySettings* proxySettings = proxyContext->proxySettings;
   const struct ListenAddrInfo* listenAddrInfo;
 
   SIMPLEQ_FOREACH(listenAddrInfo,
@@ -135,6 +678,8 @@ static void setupServerSockets(struct ProxyContext* proxyContext)
     struct ServerSocketInfo* serverSocketInfo =
       checkedCallocOne(sizeof(struct ServerSocketInfo));
     serverSocketInfo->handleReadyEventFunction = handleServerSocketReady;
+    serverSocketInfo->listenAddrInfo = listenAddrInfo;
+    serverSocketInfo->handleClientSocketFunction = handleClientSocketFunction;
 
     if (!addrInfoToNameAndPort(listenAddrInfo->addrinfo,
                                &serverAddrPortStrings))
@@ -161,6 +706,17 @@ static void setupServerSockets(struct ProxyContext* proxyContext)
       goto fail;
     }
 
+    /* every event loop thread binds its own copy of each listener */
+    if ((proxySettings->numThreads > 1) &&
+        (!proxySettings->acceptorThread) &&
+        (!setSocketReusePort(serverSocketInfo->socket)))
+    {
+      proxyLog("setSocketReusePort error on server socket %s:%s",
+               serverAddrPortStrings.addrString,
+               serverAddrPortStrings.portString);
+      goto fail;
+    }
+
     if (!bindSocket(serverSocketInfo->socket, listenAddrInfo->addrinfo))
     {
       proxyLog("bind error on server socket %s:%s",
@@ -177,10 +733,11 @@ static void setupServerSockets(struct ProxyContext* proxyContext)
       goto fail;
     }
 
-    proxyLog("listening on %s:%s (fd=%d)", 
+    proxyLog("listening on %s:%s (fd=%d,thread=%u)",
              serverAddrPortStrings.addrString,
              serverAddrPortStrings.portString,
-             serverSocketInfo->socket);
+             serverSocketInfo->socket,
+             proxyContext->threadIndex);
 
     addPollFDForRead(
       proxyContext->pollState,
@@ -188,6 +745,8 @@ static void setupServerSockets(struct ProxyContext* proxyContext)
       serverSocketInfo);
   }
 
+  flushPollState(proxyContext->pollState);
+
   return;
 
 fail:
@@ -200,8 +759,13 @@ static void addConnectionSocketInfoToPollState(
 {
   if (connectionSocketInfo->waitingForConnect)
   {
-    addPollFDForWriteAndTimeout(
+    addPollFDForWrite(
+      proxyContext->pollState,
+      connectionSocketInfo->socket,
+      connectionSocketInfo);
+    addPollTimer(
       proxyContext->pollState,
+      &(connectionSocketInfo->connectTimer),
       connectionSocketInfo->socket,
       connectionSocketInfo,
       proxyContext->proxySettings->connectTimeoutMS);
@@ -213,17 +777,27 @@ static void addConnectionSocketInfoToPollState(
       connectionSocketInfo->socket,
       connectionSocketInfo);
   }
+  if (connectionSocketInfo->waitingForWrite)
+  {
+    addPollFDForWrite(
+      proxyContext->pollState,
+      connectionSocketInfo->socket,
+      connectionSocketInfo);
+  }
 }
 
 static void removeConnectionSocketInfoFromPollState(
   struct ProxyContext* proxyContext,
-  const struct ConnectionSocketInfo* connectionSocketInfo)
+  struct ConnectionSocketInfo* connectionSocketInfo)
 {
   if (connectionSocketInfo->waitingForConnect)
   {
-    removePollFDForWriteAndTimeout(
+    removePollFDForWrite(
       proxyContext->pollState,
       connectionSocketInfo->socket);
+    removePollTimer(
+      proxyContext->pollState,
+      &(connectionSocketInfo->connectTimer));
   }
   if (connectionSocketInfo->waitingForRead)
   {
@@ -231,64 +805,96 @@ static void removeConnectionSocketInfoFromPollState(
       proxyContext->pollState,
       connectionSocketInfo->socket);
   }
+  if (connectionSocketInfo->waitingForWrite)
+  {
+    removePollFDForWrite(
+      proxyContext->pollState,
+      connectionSocketInfo->socket);
+  }
 }
 
-static bool getClientSocketAddresses(
-  const int clientSocket,
-  const struct SockAddrInfo* clientSockAddrInfo,
-  struct AddrPortStrings* clientAddrPortStrings,
-  struct AddrPortStrings* serverAddrPortStrings)
+static void setWaitingForRead(
+  struct ProxyContext* proxyContext,
+  struct ConnectionSocketInfo* connectionSocketInfo,
+  bool waitingForRead)
 {
-  struct SockAddrInfo serverSockAddrInfo;
-
-  if (!sockAddrInfoToNameAndPort(clientSockAddrInfo,
-                                 clientAddrPortStrings))
+  if (connectionSocketInfo->waitingForRead == waitingForRead)
   {
-    proxyLog("error getting client adddress port strings");
-    goto fail;
+    return;
   }
 
-  if (!getSocketName(clientSocket,
-                     &serverSockAddrInfo))
+  connectionSocketInfo->waitingForRead = waitingForRead;
+  if (waitingForRead)
   {
-    proxyLog("client getsockname error errno = %d: %s",
-             errno, errnoToString(errno));
-    goto fail;
+    addPollFDForRead(
+      proxyContext->pollState,
+      connectionSocketInfo->socket,
+      connectionSocketInfo);
   }
-
-  if (!sockAddrInfoToNameAndPort(&serverSockAddrInfo,
-                                 serverAddrPortStrings))
+  else
   {
-    proxyLog("error getting proxy server address port strings");
-    goto fail;
+    removePollFDForRead(
+      proxyContext->pollState,
+      connectionSocketInfo->socket);
   }
-
-  proxyLog("connect client to proxy %s:%s -> %s:%s (fd=%d)",
-           clientAddrPortStrings->addrString,
-           clientAddrPortStrings->portString,
-           serverAddrPortStrings->addrString,
-           serverAddrPortStrings->portString,
-           clientSocket);
-
-  return true;
-
-fail:
-  return false;
 }
 
-static const struct RemoteAddrInfo* chooseRemoteAddrInfo(
-  const struct ProxySettings* proxySettings)
+static void setWaitingForWrite(
+  struct ProxyContext* proxyContext,
+  struct ConnectionSocketInfo* connectionSocketInfo,
+  bool waitingForWrite)
 {
-  const size_t remoteAddrInfoIndex =
-    arc4random_uniform(
-      proxySettings->remoteAddrInfoArrayLength);
-  const struct RemoteAddrInfo* remoteAddrInfo =
-    proxySettings->remoteAddrInfoArray + remoteAddrInfoIndex;
+  if (connectionSocketInfo->waitingForWrite == waitingForWrite)
+  {
+    return;
+  }
 
-  proxyLog("remote address %s:%s (index=%zu)",
-           remoteAddrInfo->addrPortStrings.addrString,
-           remoteAddrInfo->addrPortStrings.portString,
-           remoteAddrInfoIndex);
+  connectionSocketInfo->waitingForWrite = waitingForWrite;
+  if (waitingForWrite)
+  {
+    addPollFDForWrite(
+      proxyContext->pollState,
+      connectionSocketInfo->socket,
+      connectionSocketInfo);
+  }
+  else
+  {
+    removePollFDForWrite(
+      proxyContext->pollState,
+      connectionSocketInfo->socket);
+  }
+}
+
+static const struct RemoteAddrInfo* chooseRemoteAddrInfo(
+  struct ProxyContext* proxyContext,
+  const struct ConnectionPair* connectionPair,
+  size_t excludeRemoteIndex)
+{
+  const struct ProxySettings* proxySettings = proxyContext->proxySettings;
+  const size_t remoteAddrInfoIndex =
+    chooseRemoteIndex(proxyContext->remoteSelector,
+                      &(connectionPair->clientSockAddr),
+                      excludeRemoteIndex);
+  const struct RemoteAddrInfo* remoteAddrInfo;
+
+  if (remoteAddrInfoIndex == NO_REMOTE_INDEX)
+  {
+    if (!proxySettings->quiet)
+    {
+      proxyLog("all remotes at max sessions");
+    }
+    return NULL;
+  }
+
+  remoteAddrInfo = proxySettings->remoteAddrInfoArray + remoteAddrInfoIndex;
+
+  if (!proxySettings->quiet)
+  {
+    proxyLog("remote address %s:%s (index=%zu)",
+             remoteAddrInfo->addrPortStrings.addrString,
+             remoteAddrInfo->addrPortStrings.portString,
+             remoteAddrInfoIndex);
+  }
 
   return remoteAddrInfo;
 }
@@ -297,30 +903,37 @@ enum RemoteSocketStatus
 {
   REMOTE_SOCKET_ERROR,
   REMOTE_SOCKET_CONNECTED,
-  REMOTE_SOCKET_IN_PROGRESS
+  REMOTE_SOCKET_IN_PROGRESS,
+  REMOTE_SOCKET_ALL_FULL
 };
 
+/* localError is set with REMOTE_SOCKET_ERROR when the proxy itself
+   failed, before or after the connect, so the remote is not to blame. */
 struct RemoteSocketResult
 {
   enum RemoteSocketStatus status;
   int remoteSocket;
+  bool fromWarmPool;
+  bool localError;
 };
 
 static struct RemoteSocketResult createRemoteSocket(
+  const struct ProxyContext* proxyContext,
   const int clientSocket,
-  const struct RemoteAddrInfo* remoteAddrInfo,
-  struct AddrPortStrings* proxyClientAddrPortStrings)
+  const struct RemoteAddrInfo* remoteAddrInfo)
 {
   enum ConnectSocketResult connectSocketResult;
-  struct SockAddrInfo proxyClientSockAddrInfo;
   struct RemoteSocketResult result;
   result.status = REMOTE_SOCKET_ERROR;
+  result.fromWarmPool = false;
+  result.localError = false;
 
   if (!createNonBlockingSocket(
          remoteAddrInfo->addrinfo,
          &(result.remoteSocket)))
   {
     proxyLog("error creating remote socket errno = %d", errno);
+    result.localError = true;
     goto fail;
   }
 
@@ -339,38 +952,14 @@ static struct RemoteSocketResult createRemoteSocket(
   else
   {
     result.status = REMOTE_SOCKET_CONNECTED;
-    if (!setBidirectionalSplice(clientSocket, result.remoteSocket))
+    if (!setupRelay(proxyContext, clientSocket, result.remoteSocket))
     {
       proxyLog("splice setup error");
+      result.localError = true;
       goto failWithSocket;
     }
   }
 
-  if (!getSocketName(result.remoteSocket, 
-                     &proxyClientSockAddrInfo))
-  {
-    proxyLog("remote getsockname error errno = %d: %s",
-             errno, errnoToString(errno));
-    goto failWithSocket;
-  }
-
-  if (!sockAddrInfoToNameAndPort(&proxyClientSockAddrInfo,
-                                 proxyClientAddrPortStrings))
-  {
-    proxyLog("error getting proxy client address name and port");
-    goto failWithSocket;
-  }
-
-  proxyLog("connect %s proxy to remote %s:%s -> %s:%s (fd=%d)",
-           ((result.status == REMOTE_SOCKET_CONNECTED) ?
-            "complete" :
-            "starting"),
-           proxyClientAddrPortStrings->addrString,
-           proxyClientAddrPortStrings->portString,
-           remoteAddrInfo->addrPortStrings.addrString,
-           remoteAddrInfo->addrPortStrings.portString,
-           result.remoteSocket);
-
   return result;
 
 failWithSocket:
@@ -382,242 +971,1810 @@ fail:
   return result;
 }
 
-static void handleNewClientSocket(
-  const int clientSocket,
-  const struct SockAddrInfo* clientSockAddrInfo,
-  struct ProxyContext* proxyContext)
+static struct WarmConnectionInfo* getRemoteWarmConnectionInfoArray(
+  const struct ProxyContext* proxyContext,
+  size_t remoteIndex)
 {
-  struct RemoteSocketResult remoteSocketResult;
-  struct ConnectionSocketInfo* connInfo1 =
-    checkedCallocOne(sizeof(struct ConnectionSocketInfo));
-  struct ConnectionSocketInfo* connInfo2 = NULL;
-  const struct RemoteAddrInfo* remoteAddrInfo;
-
-  connInfo1->handleReadyEventFunction = handleConnectionSocketReady;
-  connInfo1->type = CLIENT_TO_PROXY;
-  connInfo1->socket = clientSocket;
-
-  if (!getClientSocketAddresses(
-         clientSocket,
-         clientSockAddrInfo,
-         &(connInfo1->clientAddrPortStrings),
-         &(connInfo1->serverAddrPortStrings)))
-  {
-    goto fail;
-  }
-
-  connInfo2 = checkedCallocOne(sizeof(struct ConnectionSocketInfo));
-  connInfo2->handleReadyEventFunction = handleConnectionSocketReady;
-  connInfo2->type = PROXY_TO_REMOTE;
+  return (proxyContext->warmConnectionInfoArray +
+          (remoteIndex * proxyContext->proxySettings->warmConnections));
+}
 
-  remoteAddrInfo = chooseRemoteAddrInfo(proxyContext->proxySettings);
+static size_t getNumIdleWarmConnections(
+  const struct ProxyContext* proxyContext,
+  size_t remoteIndex)
+{
+  const struct WarmConnectionInfo* warmConnectionInfo;
+  const struct WarmConnectionInfo* endWarmConnectionInfo;
+  size_t numIdle = 0;
 
-  remoteSocketResult =
-    createRemoteSocket(clientSocket,
-                       remoteAddrInfo,
-                       &(connInfo2->clientAddrPortStrings));
-  if (remoteSocketResult.status == REMOTE_SOCKET_ERROR)
+  if (proxyContext->warmConnectionInfoArray == NULL)
   {
-    goto fail;
+    return 0;
   }
-  connInfo2->socket = remoteSocketResult.remoteSocket;
-
-  memcpy(&(connInfo2->serverAddrPortStrings),
-         &(remoteAddrInfo->addrPortStrings),
-         sizeof(struct AddrPortStrings));
 
-  if (remoteSocketResult.status == REMOTE_SOCKET_CONNECTED)
-  {
-    connInfo1->waitingForRead = true;
-    connInfo2->waitingForRead = true;
-  }
-  else if (remoteSocketResult.status == REMOTE_SOCKET_IN_PROGRESS)
+  warmConnectionInfo =
+    getRemoteWarmConnectionInfoArray(proxyContext, remoteIndex);
+  endWarmConnectionInfo =
+    warmConnectionInfo + proxyContext->proxySettings->warmConnections;
+  for (; warmConnectionInfo != endWarmConnectionInfo; ++warmConnectionInfo)
   {
-    connInfo2->waitingForConnect = true;
+    if (warmConnectionInfo->state == WARM_CONNECTION_IDLE)
+    {
+      ++numIdle;
+    }
   }
 
-  connInfo1->relatedConnectionSocketInfo = connInfo2;
-  connInfo2->relatedConnectionSocketInfo = connInfo1;
-
-  addConnectionSocketInfoToPollState(proxyContext, connInfo1);
-  addConnectionSocketInfoToPollState(proxyContext, connInfo2);
-
-  addToTAILQ(proxyContext->activeList, connInfo1);
-  addToTAILQ(proxyContext->activeList, connInfo2);
-
-  return;
+  return numIdle;
+}
 
-fail:
-  free(connInfo1);
-  free(connInfo2);
-  signalSafeClose(clientSocket);
+static void startWarmConnectionTimer(
+  struct ProxyContext* proxyContext,
+  struct WarmConnectionInfo* warmConnectionInfo,
+  uint32_t timeoutMilliseconds)
+{
+  addPollTimer(
+    proxyContext->pollState,
+    &(warmConnectionInfo->timer),
+    WARM_CONNECTION_TIMER_ID,
+    warmConnectionInfo,
+    timeoutMilliseconds);
 }
 
-static void markForDestruction(
-  struct ConnectionSocketInfo* connectionSocketInfo,
-  struct ProxyContext* proxyContext)
+static void closeWarmConnection(
+  struct ProxyContext* proxyContext,
+  struct WarmConnectionInfo* warmConnectionInfo)
 {
-  struct ConnectionSocketInfo* relatedConnectionSocketInfo = 
-    connectionSocketInfo->relatedConnectionSocketInfo;
+  removePollTimer(proxyContext->pollState, &(warmConnectionInfo->timer));
 
-  if (!connectionSocketInfo->markedForDestruction)
+  if (warmConnectionInfo->state == WARM_CONNECTION_CONNECTING)
   {
-    connectionSocketInfo->markedForDestruction = true;
-    removeFromTAILQ(proxyContext->activeList, connectionSocketInfo);
-    addToTAILQ(proxyContext->destroyedList, connectionSocketInfo);
+    removePollFDForWrite(proxyContext->pollState, warmConnectionInfo->socket);
+    flushPollState(proxyContext->pollState);
   }
 
-  if (!relatedConnectionSocketInfo->markedForDestruction)
+  if (warmConnectionInfo->socket != -1)
   {
-    relatedConnectionSocketInfo->markedForDestruction = true;
-    removeFromTAILQ(proxyContext->activeList, relatedConnectionSocketInfo);
-    addToTAILQ(proxyContext->destroyedList, relatedConnectionSocketInfo);
+    signalSafeClose(warmConnectionInfo->socket);
+    warmConnectionInfo->socket = -1;
   }
+
+  warmConnectionInfo->state = WARM_CONNECTION_EMPTY;
 }
 
-static void printDisconnectMessage(
-  const struct ConnectionSocketInfo* connectionSocketInfo)
+/* The slot stays empty until the retry delay has passed. */
+static void failWarmConnection(
+  struct ProxyContext* proxyContext,
+  struct WarmConnectionInfo* warmConnectionInfo)
 {
-  const char* typeString =
-    ((connectionSocketInfo->type == CLIENT_TO_PROXY) ?
-     "client to proxy" :
-     "proxy to remote");
-  proxyLog("disconnect %s %s:%s -> %s:%s (fd=%d,bytes=%jd)",
-           typeString,
-           connectionSocketInfo->clientAddrPortStrings.addrString,
-           connectionSocketInfo->clientAddrPortStrings.portString,
-           connectionSocketInfo->serverAddrPortStrings.addrString,
-           connectionSocketInfo->serverAddrPortStrings.portString,
-           connectionSocketInfo->socket,
-           (intmax_t)getSpliceBytesTransferred(connectionSocketInfo->socket));
+  addRemoteConnectResultSample(proxyContext,
+                               warmConnectionInfo->remoteIndex,
+                               warmConnectionInfo->connectStartTimeUS,
+                               false);
+  closeWarmConnection(proxyContext, warmConnectionInfo);
+  startWarmConnectionTimer(proxyContext, warmConnectionInfo,
+                           WARM_CONNECTION_RETRY_MS);
 }
 
-static void destroyConnection(
+static void setWarmConnectionIdle(
   struct ProxyContext* proxyContext,
-  struct ConnectionSocketInfo* connectionSocketInfo)
+  struct WarmConnectionInfo* warmConnectionInfo)
 {
-  struct ConnectionSocketInfo* relatedConnectionSocketInfo =
-    connectionSocketInfo->relatedConnectionSocketInfo;
+  addRemoteConnectResultSample(proxyContext,
+                               warmConnectionInfo->remoteIndex,
+                               warmConnectionInfo->connectStartTimeUS,
+                               true);
+  warmConnectionInfo->state = WARM_CONNECTION_IDLE;
+  startWarmConnectionTimer(proxyContext, warmConnectionInfo,
+                           proxyContext->proxySettings->warmIdleMS);
+}
 
-  printDisconnectMessage(connectionSocketInfo);
+static void startWarmConnection(
+  struct ProxyContext* proxyContext,
+  struct WarmConnectionInfo* warmConnectionInfo)
+{
+  const struct ProxySettings* proxySettings = proxyContext->proxySettings;
+  const struct RemoteAddrInfo* remoteAddrInfo =
+    proxySettings->remoteAddrInfoArray + warmConnectionInfo->remoteIndex;
+  enum ConnectSocketResult connectSocketResult;
 
-  removeConnectionSocketInfoFromPollState(proxyContext, connectionSocketInfo);
-  signalSafeClose(connectionSocketInfo->socket);
+  warmConnectionInfo->connectStartTimeUS = getMonotonicTimeUS();
 
-  free(connectionSocketInfo);
-  connectionSocketInfo = NULL;
+  /* the remote is not to blame, no connect result is counted */
+  if (!createNonBlockingSocket(remoteAddrInfo->addrinfo,
+                               &(warmConnectionInfo->socket)))
+  {
+    proxyLog("error creating warm connection socket errno = %d", errno);
+    warmConnectionInfo->socket = -1;
+    closeWarmConnection(proxyContext, warmConnectionInfo);
+    startWarmConnectionTimer(proxyContext, warmConnectionInfo,
+                             WARM_CONNECTION_RETRY_MS);
+    return;
+  }
 
-  if (relatedConnectionSocketInfo != NULL)
+  connectSocketResult =
+    connectSocket(warmConnectionInfo->socket, remoteAddrInfo->addrinfo);
+  if (connectSocketResult == CONNECT_SOCKET_RESULT_IN_PROGRESS)
   {
-    relatedConnectionSocketInfo->relatedConnectionSocketInfo = NULL;
+    warmConnectionInfo->state = WARM_CONNECTION_CONNECTING;
+    addPollFDForWrite(
+      proxyContext->pollState,
+      warmConnectionInfo->socket,
+      warmConnectionInfo);
+    startWarmConnectionTimer(proxyContext, warmConnectionInfo,
+                             proxySettings->connectTimeoutMS);
+  }
+  else if (connectSocketResult == CONNECT_SOCKET_RESULT_CONNECTED)
+  {
+    setWarmConnectionIdle(proxyContext, warmConnectionInfo);
+  }
+  else
+  {
+    if (!proxySettings->quiet)
+    {
+      proxyLog("warm connection connect error errno = %d: %s",
+               errno, errnoToString(errno));
+    }
+    failWarmConnection(proxyContext, warmConnectionInfo);
   }
 }
 
-static void destroyMarkedConnections(
+static void handleWarmConnectionReady(
+  struct AbstractReadyEventHandler* abstractReadyEventHandler,
+  const struct ReadyEventInfo* readyEventInfo,
   struct ProxyContext* proxyContext)
 {
-  struct ConnectionSocketInfo* connectionSocketInfo;
+  struct WarmConnectionInfo* warmConnectionInfo =
+    (struct WarmConnectionInfo*) abstractReadyEventHandler;
+  int socketError;
 
-  while ((connectionSocketInfo =
-          removeFirstFromTAILQ(proxyContext->destroyedList)) != NULL)
+  if (isReadyEventForTimeout(readyEventInfo))
   {
-    destroyConnection(proxyContext, connectionSocketInfo);
+    /* an active timer was restarted after this timeout fired */
+    if (isPollTimerActive(&(warmConnectionInfo->timer)))
+    {
+      return;
+    }
+
+    if (warmConnectionInfo->state == WARM_CONNECTION_CONNECTING)
+    {
+      if (!proxyContext->proxySettings->quiet)
+      {
+        proxyLog("warm connection connect timeout fd %d",
+                 warmConnectionInfo->socket);
+      }
+      failWarmConnection(proxyContext, warmConnectionInfo);
+      return;
+    }
+
+    /* an idle connection past the idle limit is replaced */
+    closeWarmConnection(proxyContext, warmConnectionInfo);
+    startWarmConnection(proxyContext, warmConnectionInfo);
+    return;
   }
-}
 
-static struct ConnectionSocketInfo* handleConnectionReadyForRead(
-  struct ConnectionSocketInfo* connectionSocketInfo,
-  struct ProxyContext* proxyContext)
-{
-  struct ConnectionSocketInfo* disconnectSocketInfo = NULL;
+  /* a write event queued behind a connect that already ended is ignored */
+  if ((!isReadyEventForWrite(readyEventInfo)) ||
+      (warmConnectionInfo->state != WARM_CONNECTION_CONNECTING))
+  {
+    return;
+  }
 
-  if (connectionSocketInfo->waitingForRead)
+  socketError = getSocketError(warmConnectionInfo->socket);
+  if (socketError == EINPROGRESS)
   {
-    proxyLog("splice read error fd %d", connectionSocketInfo->socket);
-    disconnectSocketInfo = connectionSocketInfo;
+    return;
   }
 
-  return disconnectSocketInfo;
+  if (socketError != 0)
+  {
+    if (!proxyContext->proxySettings->quiet)
+    {
+      proxyLog("async warm connection connect fd %d errno %d: %s",
+               warmConnectionInfo->socket,
+               socketError,
+               errnoToString(socketError));
+    }
+    failWarmConnection(proxyContext, warmConnectionInfo);
+    return;
+  }
+
+  removePollFDForWrite(proxyContext->pollState, warmConnectionInfo->socket);
+  removePollTimer(proxyContext->pollState, &(warmConnectionInfo->timer));
+  setWarmConnectionIdle(proxyContext, warmConnectionInfo);
 }
 
-static struct ConnectionSocketInfo* handleConnectionReadyForWrite(
-  struct ConnectionSocketInfo* connectionSocketInfo,
-  struct ProxyContext* proxyContext)
+/*
+ * Splices the client to an idle warm connection of the remote and
+ * starts refilling its slot.  Idle connections the remote has closed are
+ * replaced on the way.  Returns REMOTE_SOCKET_ERROR if none was usable.
+ */
+static struct RemoteSocketResult takeWarmConnection(
+  struct ProxyContext* proxyContext,
+  const int clientSocket,
+  size_t remoteIndex)
 {
-  struct ConnectionSocketInfo* relatedConnectionSocketInfo =
-    connectionSocketInfo->relatedConnectionSocketInfo;
+  struct WarmConnectionInfo* warmConnectionInfo;
+  const struct WarmConnectionInfo* endWarmConnectionInfo;
+  struct RemoteSocketResult result;
+  result.status = REMOTE_SOCKET_ERROR;
+  result.remoteSocket = -1;
+  result.fromWarmPool = false;
+  result.localError = false;
 
-  if (connectionSocketInfo->waitingForConnect)
+  if (proxyContext->warmConnectionInfoArray == NULL)
   {
-    const int socketError = getSocketError(connectionSocketInfo->socket);
-    if (socketError == EINPROGRESS)
+    return result;
+  }
+
+  warmConnectionInfo =
+    getRemoteWarmConnectionInfoArray(proxyContext, remoteIndex);
+  endWarmConnectionInfo =
+    warmConnectionInfo + proxyContext->proxySettings->warmConnections;
+  for (; warmConnectionInfo != endWarmConnectionInfo; ++warmConnectionInfo)
+  {
+    if (warmConnectionInfo->state != WARM_CONNECTION_IDLE)
     {
-      /* do nothing, still in progress */
+      continue;
     }
-    else if (socketError != 0)
+
+    if (!isSocketPeerOpen(warmConnectionInfo->socket))
     {
-      proxyLog("async remote connect fd %d errno %d: %s",
-               connectionSocketInfo->socket,
-               socketError,
-               errnoToString(socketError));
-      goto fail;
+      closeWarmConnection(proxyContext, warmConnectionInfo);
+      startWarmConnection(proxyContext, warmConnectionInfo);
+      continue;
     }
-    else
+
+    removePollTimer(proxyContext->pollState, &(warmConnectionInfo->timer));
+    result.remoteSocket = warmConnectionInfo->socket;
+    warmConnectionInfo->socket = -1;
+    warmConnectionInfo->state = WARM_CONNECTION_EMPTY;
+    startWarmConnection(proxyContext, warmConnectionInfo);
+
+    if (!setupRelay(proxyContext, clientSocket, result.remoteSocket))
     {
-      proxyLog("connect complete proxy to remote %s:%s -> %s:%s (fd=%d)",
-               connectionSocketInfo->clientAddrPortStrings.addrString,
-               connectionSocketInfo->clientAddrPortStrings.portString,
-               connectionSocketInfo->serverAddrPortStrings.addrString,
-               connectionSocketInfo->serverAddrPortStrings.portString,
-               connectionSocketInfo->socket);
+      proxyLog("splice setup error");
+      signalSafeClose(result.remoteSocket);
+      result.remoteSocket = -1;
+      break;
+    }
 
-      if (!setBidirectionalSplice(
-             connectionSocketInfo->socket,
-             relatedConnectionSocketInfo->socket))
-      {
-        proxyLog("splice setup error");
-        goto fail;
-      }
+    result.status = REMOTE_SOCKET_CONNECTED;
+    result.fromWarmPool = true;
+    break;
+  }
 
-      removeConnectionSocketInfoFromPollState(
-        proxyContext, connectionSocketInfo);
-      removeConnectionSocketInfoFromPollState(
-        proxyContext, relatedConnectionSocketInfo);
+  return result;
+}
 
-      connectionSocketInfo->waitingForConnect = false;
-      connectionSocketInfo->waitingForRead = true;
-      addConnectionSocketInfoToPollState(
-        proxyContext, connectionSocketInfo);
+/*
+ * Starts a connect to a remote other than excludeRemoteIndex.  After an
+ * immediate connect error another remote is tried while the session's
+ * retry budget lasts.  connectionPair only takes the new remote if a
+ * connect is started.  REMOTE_SOCKET_ALL_FULL means no remote was below
+ * its max sessions.
+ */
+static struct RemoteSocketResult connectToRemote(
+  struct ProxyContext* proxyContext,
+  struct ConnectionPair* connectionPair,
+  size_t excludeRemoteIndex)
+{
+  const struct ProxySettings* proxySettings = proxyContext->proxySettings;
+  struct RemoteSocketResult remoteSocketResult;
 
-      relatedConnectionSocketInfo->waitingForConnect = false;
-      relatedConnectionSocketInfo->waitingForRead = true;
-      addConnectionSocketInfoToPollState(
-        proxyContext, relatedConnectionSocketInfo);
+  while (true)
+  {
+    const uint64_t connectStartTimeUS = getMonotonicTimeUS();
+    const struct RemoteAddrInfo* remoteAddrInfo =
+      chooseRemoteAddrInfo(proxyContext, connectionPair, excludeRemoteIndex);
+
+    if (remoteAddrInfo == NULL)
+    {
+      remoteSocketResult.status = REMOTE_SOCKET_ALL_FULL;
+      remoteSocketResult.remoteSocket = -1;
+      remoteSocketResult.fromWarmPool = false;
+      remoteSocketResult.localError = false;
+      break;
     }
-  }
 
-  return NULL;
+    remoteSocketResult =
+      takeWarmConnection(proxyContext,
+                         connectionPair->clientConnectionSocketInfo.socket,
+                         remoteAddrInfo - proxySettings->remoteAddrInfoArray);
+    if (remoteSocketResult.status == REMOTE_SOCKET_ERROR)
+    {
+      remoteSocketResult =
+        createRemoteSocket(proxyContext,
+                           connectionPair->clientConnectionSocketInfo.socket,
+                           remoteAddrInfo);
+    }
+    if (remoteSocketResult.status != REMOTE_SOCKET_ERROR)
+    {
+      connectionPair->remoteAddrInfo = remoteAddrInfo;
+      connectionPair->connectStartTimeUS = connectStartTimeUS;
+      break;
+    }
 
-fail:
-  return connectionSocketInfo;
+    excludeRemoteIndex =
+      remoteAddrInfo - proxySettings->remoteAddrInfoArray;
+    if (!remoteSocketResult.localError)
+    {
+      addRemoteConnectResultSample(proxyContext, excludeRemoteIndex,
+                                   connectStartTimeUS, false);
+    }
+
+    if (connectionPair->numConnectRetries >= proxySettings->connectRetries)
+    {
+      break;
+    }
+    ++(connectionPair->numConnectRetries);
+  }
+
+  return remoteSocketResult;
 }
 
-static struct ConnectionSocketInfo* handleConnectionReadyForTimeout(
-  struct ConnectionSocketInfo* connectionSocketInfo,
-  struct ProxyContext* proxyContext)
+static void startRaceConnectDelay(
+  struct ProxyContext* proxyContext,
+  struct ConnectionPair* connectionPair)
 {
-  struct ConnectionSocketInfo* disconnectSocketInfo = NULL;
+  const struct ProxySettings* proxySettings = proxyContext->proxySettings;
+  struct RaceConnectInfo* raceConnectInfo = &(connectionPair->raceConnectInfo);
 
-  if (connectionSocketInfo->waitingForConnect)
+  if ((proxySettings->raceConnectDelayMS == 0) ||
+      (proxySettings->remoteAddrInfoArrayLength < 2) ||
+      raceConnectInfo->waitingForDelay ||
+      (raceConnectInfo->socket != -1))
   {
-    proxyLog("connect timeout fd %d", connectionSocketInfo->socket);
-    disconnectSocketInfo = connectionSocketInfo;
+    return;
   }
 
-  return disconnectSocketInfo;
+  raceConnectInfo->waitingForDelay = true;
+  addPollTimer(
+    proxyContext->pollState,
+    &(raceConnectInfo->delayTimer),
+    RACE_CONNECT_TIMER_ID,
+    raceConnectInfo,
+    proxySettings->raceConnectDelayMS);
 }
 
-static void handleConnectionSocketReady(
+static void removeRaceConnectFromPollState(
+  struct ProxyContext* proxyContext,
+  struct RaceConnectInfo* raceConnectInfo)
+{
+  if (raceConnectInfo->waitingForDelay)
+  {
+    removePollTimer(
+      proxyContext->pollState,
+      &(raceConnectInfo->delayTimer));
+    raceConnectInfo->waitingForDelay = false;
+  }
+  if (raceConnectInfo->socket != -1)
+  {
+    removePollFDForWrite(
+      proxyContext->pollState,
+      raceConnectInfo->socket);
+  }
+}
+
+static void closeRaceConnect(
+  struct RaceConnectInfo* raceConnectInfo)
+{
+  if (raceConnectInfo->socket != -1)
+  {
+    signalSafeClose(raceConnectInfo->socket);
+    raceConnectInfo->socket = -1;
+  }
+}
+
+static void stopRaceConnect(
+  struct ProxyContext* proxyContext,
+  struct RaceConnectInfo* raceConnectInfo)
+{
+  removeRaceConnectFromPollState(proxyContext, raceConnectInfo);
+  flushPollState(proxyContext->pollState);
+  closeRaceConnect(raceConnectInfo);
+}
+
+static void setupSessionRateLimit(
+  struct ProxyContext* proxyContext,
+  struct ConnectionPair* connectionPair,
+  const struct ListenAddrInfo* listenAddrInfo)
+{
+  const uint64_t sessionBytesPerSecond =
+    proxyContext->proxySettings->sessionBytesPerSecond;
+
+  if (sessionBytesPerSecond > 0)
+  {
+    initTokenBucket(&(connectionPair->clientConnectionSocketInfo.tokenBucket),
+                    sessionBytesPerSecond, RATE_LIMIT_REFILL_MS);
+    initTokenBucket(&(connectionPair->remoteConnectionSocketInfo.tokenBucket),
+                    sessionBytesPerSecond, RATE_LIMIT_REFILL_MS);
+  }
+
+  if (listenAddrInfo->bytesPerSecond > 0)
+  {
+    struct ListenRateLimit* listenRateLimit =
+      proxyContext->rateLimitInfo->listenRateLimitArray +
+      listenAddrInfo->index;
+    connectionPair->clientConnectionSocketInfo.listenTokenBucket =
+      &(listenRateLimit->clientTokenBucket);
+    connectionPair->remoteConnectionSocketInfo.listenTokenBucket =
+      &(listenRateLimit->remoteTokenBucket);
+    connectionPair->listenRateLimit = listenRateLimit;
+    ++(listenRateLimit->numSessions);
+  }
+}
+
+/*
+ * Returns false, leaving clientSocket open, if every remote is at its max
+ * sessions.  Otherwise the client is in a new session or already closed.
+ */
+static bool startClientSession(
+  const int clientSocket,
+  const struct SockAddrInfo* clientSockAddrInfo,
+  const struct ListenAddrInfo* listenAddrInfo,
+  struct ProxyContext* proxyContext)
+{
+  const struct ProxySettings* proxySettings = proxyContext->proxySettings;
+  struct RemoteSocketResult remoteSocketResult;
+  struct ConnectionPair* connectionPair =
+    allocateObjectPoolObject(proxyContext->connectionPairPool);
+  struct ConnectionSocketInfo* connInfo1 =
+    &(connectionPair->clientConnectionSocketInfo);
+  struct ConnectionSocketInfo* connInfo2 =
+    &(connectionPair->remoteConnectionSocketInfo);
+
+  connInfo1->handleReadyEventFunction = handleConnectionSocketReady;
+  connInfo1->type = CLIENT_TO_PROXY;
+  connInfo1->socket = clientSocket;
+
+  sockAddrInfoToCompactSockAddr(clientSockAddrInfo,
+                                &(connectionPair->clientSockAddr));
+
+  connInfo2->handleReadyEventFunction = handleConnectionSocketReady;
+  connInfo2->type = PROXY_TO_REMOTE;
+
+  connectionPair->raceConnectInfo.handleReadyEventFunction =
+    handleRaceConnectReady;
+  connectionPair->raceConnectInfo.socket = -1;
+
+  remoteSocketResult =
+    connectToRemote(proxyContext, connectionPair, NO_REMOTE_INDEX);
+  if (remoteSocketResult.status == REMOTE_SOCKET_ALL_FULL)
+  {
+    freeObjectPoolObject(proxyContext->connectionPairPool, connectionPair);
+    return false;
+  }
+
+  /* a client waiting for a remote is only logged once it gets one */
+  if (!proxySettings->quiet)
+  {
+    printConnectMessage("connect client to proxy", connInfo1);
+  }
+
+  if (remoteSocketResult.status == REMOTE_SOCKET_ERROR)
+  {
+    goto fail;
+  }
+  connInfo2->socket = remoteSocketResult.remoteSocket;
+
+  /* a warm connection's connect time was counted when it connected */
+  if ((remoteSocketResult.status == REMOTE_SOCKET_CONNECTED) &&
+      (!remoteSocketResult.fromWarmPool))
+  {
+    addConnectResult(proxyContext, connInfo2, true);
+  }
+
+  if (!proxySettings->quiet)
+  {
+    printConnectMessage(
+      (remoteSocketResult.fromWarmPool ?
+       "connect warm proxy to remote" :
+       ((remoteSocketResult.status == REMOTE_SOCKET_CONNECTED) ?
+        "connect complete proxy to remote" :
+        "connect starting proxy to remote")),
+      connInfo2);
+  }
+
+  if (remoteSocketResult.status == REMOTE_SOCKET_CONNECTED)
+  {
+    connInfo1->waitingForRead = true;
+    connInfo2->waitingForRead = true;
+  }
+  else if (remoteSocketResult.status == REMOTE_SOCKET_IN_PROGRESS)
+  {
+    connInfo2->waitingForConnect = true;
+  }
+
+  connInfo1->relatedConnectionSocketInfo = connInfo2;
+  connInfo2->relatedConnectionSocketInfo = connInfo1;
+
+  addConnectionSocketInfoToPollState(proxyContext, connInfo1);
+  addConnectionSocketInfoToPollState(proxyContext, connInfo2);
+
+  if (connInfo2->waitingForConnect)
+  {
+    startRaceConnectDelay(proxyContext, connectionPair);
+  }
+
+  addToTAILQ(proxyContext->activeList, connInfo1);
+  addToTAILQ(proxyContext->activeList, connInfo2);
+
+  if (proxyContext->rateLimitInfo != NULL)
+  {
+    setupSessionRateLimit(proxyContext, connectionPair, listenAddrInfo);
+  }
+
+  atomic_fetch_add_explicit(
+    &(proxyContext->numSessions), 1, memory_order_relaxed);
+  addRemoteSession(proxyContext->remoteSelector,
+                   getRemoteAddrInfoIndex(proxyContext, connectionPair));
+
+  return true;
+
+fail:
+  freeObjectPoolObject(proxyContext->connectionPairPool, connectionPair);
+  signalSafeClose(clientSocket);
+  return true;
+}
+
+static struct PendingClientInfo* getPendingClientInfo(
+  struct PendingClientQueueInfo* pendingClientQueueInfo,
+  size_t position)
+{
+  return (pendingClientQueueInfo->pendingClientArray +
+          ((pendingClientQueueInfo->headIndex + position) %
+           pendingClientQueueInfo->capacity));
+}
+
+static void removeFirstPendingClient(
+  struct PendingClientQueueInfo* pendingClientQueueInfo)
+{
+  pendingClientQueueInfo->headIndex =
+    (pendingClientQueueInfo->headIndex + 1) %
+    pendingClientQueueInfo->capacity;
+  --(pendingClientQueueInfo->numPendingClients);
+}
+
+static void restartPendingClientTimer(
+  struct ProxyContext* proxyContext)
+{
+  struct PendingClientQueueInfo* pendingClientQueueInfo =
+    proxyContext->pendingClientQueueInfo;
+  const uint64_t nowMS = getMonotonicTimeMS();
+  const struct PendingClientInfo* firstPendingClientInfo;
+  uint64_t timeoutMS = 0;
+
+  removePollTimer(proxyContext->pollState,
+                  &(pendingClientQueueInfo->deadlineTimer));
+
+  if (pendingClientQueueInfo->numPendingClients == 0)
+  {
+    return;
+  }
+
+  firstPendingClientInfo = getPendingClientInfo(pendingClientQueueInfo, 0);
+  if (firstPendingClientInfo->deadlineMS > nowMS)
+  {
+    timeoutMS = firstPendingClientInfo->deadlineMS - nowMS;
+  }
+
+  addPollTimer(
+    proxyContext->pollState,
+    &(pendingClientQueueInfo->deadlineTimer),
+    PENDING_CLIENT_TIMER_ID,
+    pendingClientQueueInfo,
+    timeoutMS);
+}
+
+static void closeHungUpPendingClient(
+  const struct ProxyContext* proxyContext,
+  const struct PendingClientInfo* pendingClientInfo)
+{
+  if (!proxyContext->proxySettings->quiet)
+  {
+    proxyLog("pending client closed by peer, closing fd %d",
+             pendingClientInfo->socket);
+  }
+  signalSafeClose(pendingClientInfo->socket);
+}
+
+/* Drops waiting clients that hung up, keeping the others in order. */
+static void removeClosedPendingClients(
+  struct ProxyContext* proxyContext)
+{
+  struct PendingClientQueueInfo* pendingClientQueueInfo =
+    proxyContext->pendingClientQueueInfo;
+  size_t position;
+  size_t numOpenClients = 0;
+
+  for (position = 0;
+       position < pendingClientQueueInfo->numPendingClients;
+       ++position)
+  {
+    const struct PendingClientInfo* pendingClientInfo =
+      getPendingClientInfo(pendingClientQueueInfo, position);
+    if (!isSocketPeerOpen(pendingClientInfo->socket))
+    {
+      closeHungUpPendingClient(proxyContext, pendingClientInfo);
+      continue;
+    }
+    if (numOpenClients != position)
+    {
+      memcpy(getPendingClientInfo(pendingClientQueueInfo, numOpenClients),
+             pendingClientInfo,
+             sizeof(struct PendingClientInfo));
+    }
+    ++numOpenClients;
+  }
+
+  if (numOpenClients != pendingClientQueueInfo->numPendingClients)
+  {
+    pendingClientQueueInfo->numPendingClients = numOpenClients;
+    restartPendingClientTimer(proxyContext);
+  }
+}
+
+/* Starts sessions for waiting clients, oldest first, while remotes have
+   room.  Clients that hung up while waiting are dropped on the way. */
+static void drainPendingClients(
+  struct ProxyContext* proxyContext)
+{
+  struct PendingClientQueueInfo* pendingClientQueueInfo =
+    proxyContext->pendingClientQueueInfo;
+  bool removedFirst = false;
+
+  if (pendingClientQueueInfo == NULL)
+  {
+    return;
+  }
+
+  while (pendingClientQueueInfo->numPendingClients > 0)
+  {
+    const struct PendingClientInfo* pendingClientInfo =
+      getPendingClientInfo(pendingClientQueueInfo, 0);
+    if (!isSocketPeerOpen(pendingClientInfo->socket))
+    {
+      closeHungUpPendingClient(proxyContext, pendingClientInfo);
+    }
+    else if (!startClientSession(pendingClientInfo->socket,
+                                 &(pendingClientInfo->clientSockAddrInfo),
+                                 pendingClientInfo->listenAddrInfo,
+                                 proxyContext))
+    {
+      break;
+    }
+    removeFirstPendingClient(pendingClientQueueInfo);
+    removedFirst = true;
+  }
+
+  if (removedFirst)
+  {
+    restartPendingClientTimer(proxyContext);
+  }
+}
+
+static void addPendingClient(
+  const int clientSocket,
+  const struct SockAddrInfo* clientSockAddrInfo,
+  const struct ListenAddrInfo* listenAddrInfo,
+  struct ProxyContext* proxyContext)
+{
+  struct PendingClientQueueInfo* pendingClientQueueInfo =
+    proxyContext->pendingClientQueueInfo;
+  struct PendingClientInfo* pendingClientInfo;
+
+  if ((pendingClientQueueInfo != NULL) &&
+      (pendingClientQueueInfo->numPendingClients >=
+       pendingClientQueueInfo->capacity))
+  {
+    removeClosedPendingClients(proxyContext);
+  }
+
+  if ((pendingClientQueueInfo == NULL) ||
+      (pendingClientQueueInfo->numPendingClients >=
+       pendingClientQueueInfo->capacity))
+  {
+    proxyLog("no room for pending client, closing fd %d", clientSocket);
+    signalSafeClose(clientSocket);
+    return;
+  }
+
+  pendingClientInfo =
+    getPendingClientInfo(pendingClientQueueInfo,
+                         pendingClientQueueInfo->numPendingClients);
+  pendingClientInfo->socket = clientSocket;
+  memcpy(&(pendingClientInfo->clientSockAddrInfo),
+         clientSockAddrInfo,
+         sizeof(struct SockAddrInfo));
+  pendingClientInfo->listenAddrInfo = listenAddrInfo;
+  pendingClientInfo->deadlineMS =
+    getMonotonicTimeMS() + proxyContext->proxySettings->pendingClientMS;
+  ++(pendingClientQueueInfo->numPendingClients);
+
+  if (!proxyContext->proxySettings->quiet)
+  {
+    proxyLog("pending client fd %d (pending=%zu)",
+             clientSocket,
+             pendingClientQueueInfo->numPendingClients);
+  }
+
+  if (pendingClientQueueInfo->numPendingClients == 1)
+  {
+    restartPendingClientTimer(proxyContext);
+  }
+}
+
+static void handleNewClientSocket(
+  const int clientSocket,
+  const struct SockAddrInfo* clientSockAddrInfo,
+  const struct ListenAddrInfo* listenAddrInfo,
+  struct ProxyContext* proxyContext)
+{
+  const struct PendingClientQueueInfo* pendingClientQueueInfo =
+    proxyContext->pendingClientQueueInfo;
+
+  /* a new client does not overtake the ones already waiting */
+  if ((pendingClientQueueInfo != NULL) &&
+      (pendingClientQueueInfo->numPendingClients > 0))
+  {
+    addPendingClient(clientSocket, clientSockAddrInfo, listenAddrInfo,
+                     proxyContext);
+    drainPendingClients(proxyContext);
+  }
+  else if (!startClientSession(clientSocket, clientSockAddrInfo,
+                               listenAddrInfo, proxyContext))
+  {
+    addPendingClient(clientSocket, clientSockAddrInfo, listenAddrInfo,
+                     proxyContext);
+  }
+}
+
+static void handlePendingClientQueueReady(
+  struct AbstractReadyEventHandler* abstractReadyEventHandler,
+  const struct ReadyEventInfo* readyEventInfo,
+  struct ProxyContext* proxyContext)
+{
+  struct PendingClientQueueInfo* pendingClientQueueInfo =
+    (struct PendingClientQueueInfo*) abstractReadyEventHandler;
+  const uint64_t nowMS = getMonotonicTimeMS();
+
+  /* an active timer was restarted after this timeout fired */
+  if (isPollTimerActive(&(pendingClientQueueInfo->deadlineTimer)))
+  {
+    return;
+  }
+
+  while ((pendingClientQueueInfo->numPendingClients > 0) &&
+         (getPendingClientInfo(pendingClientQueueInfo, 0)->deadlineMS <=
+          nowMS))
+  {
+    const int clientSocket =
+      getPendingClientInfo(pendingClientQueueInfo, 0)->socket;
+    proxyLog("pending client timeout, closing fd %d", clientSocket);
+    signalSafeClose(clientSocket);
+    removeFirstPendingClient(pendingClientQueueInfo);
+  }
+
+  restartPendingClientTimer(proxyContext);
+}
+
+static void markForDestruction(
+  struct ConnectionSocketInfo* connectionSocketInfo,
+  struct ProxyContext* proxyContext)
+{
+  struct ConnectionSocketInfo* relatedConnectionSocketInfo = 
+    connectionSocketInfo->relatedConnectionSocketInfo;
+
+  if (!connectionSocketInfo->markedForDestruction)
+  {
+    connectionSocketInfo->markedForDestruction = true;
+    removeFromTAILQ(proxyContext->activeList, connectionSocketInfo);
+    addToTAILQ(proxyContext->destroyedList, connectionSocketInfo);
+  }
+
+  if (!relatedConnectionSocketInfo->markedForDestruction)
+  {
+    relatedConnectionSocketInfo->markedForDestruction = true;
+    removeFromTAILQ(proxyContext->activeList, relatedConnectionSocketInfo);
+    addToTAILQ(proxyContext->destroyedList, relatedConnectionSocketInfo);
+  }
+}
+
+static void printDisconnectMessage(
+  const struct ConnectionSocketInfo* connectionSocketInfo)
+{
+  const char* typeString =
+    ((connectionSocketInfo->type == CLIENT_TO_PROXY) ?
+     "client to proxy" :
+     "proxy to remote");
+  struct AddrPortStrings clientAddrPortStrings;
+  struct AddrPortStrings serverAddrPortStrings;
+
+  getConnectionAddrPortStrings(connectionSocketInfo,
+                               &clientAddrPortStrings,
+                               &serverAddrPortStrings);
+
+  proxyLog("disconnect %s %s:%s -> %s:%s (fd=%d,bytes in=%jd,bytes out=%jd)",
+           typeString,
+           clientAddrPortStrings.addrString,
+           clientAddrPortStrings.portString,
+           serverAddrPortStrings.addrString,
+           serverAddrPortStrings.portString,
+           connectionSocketInfo->socket,
+           (intmax_t)connectionSocketInfo->bytesRelayed,
+           (intmax_t)getPairedConnectionSocketInfo(
+             connectionSocketInfo)->bytesRelayed);
+}
+
+static void destroyConnection(
+  struct ProxyContext* proxyContext,
+  struct ConnectionSocketInfo* connectionSocketInfo)
+{
+  struct ConnectionSocketInfo* relatedConnectionSocketInfo =
+    connectionSocketInfo->relatedConnectionSocketInfo;
+
+  if (!proxyContext->proxySettings->quiet)
+  {
+    printDisconnectMessage(connectionSocketInfo);
+  }
+
+  signalSafeClose(connectionSocketInfo->socket);
+
+  if (connectionSocketInfo->relayBuffer != NULL)
+  {
+    freeObjectPoolObject(proxyContext->relayBufferPool,
+                         connectionSocketInfo->relayBuffer);
+  }
+
+  /* a pipe with data left in it can never be handed out again */
+  if (connectionSocketInfo->holdingRelayPipe)
+  {
+    closePipePoolPipe(proxyContext->relayPipePool,
+                      connectionSocketInfo->relayPipeFDArray);
+  }
+
+  if (connectionSocketInfo->type == PROXY_TO_REMOTE)
+  {
+    closeRaceConnect(
+      &(getConnectionPair(connectionSocketInfo)->raceConnectInfo));
+  }
+
+  if (connectionSocketInfo->type == CLIENT_TO_PROXY)
+  {
+    struct ListenRateLimit* listenRateLimit =
+      getConnectionPair(connectionSocketInfo)->listenRateLimit;
+
+    atomic_fetch_sub_explicit(
+      &(proxyContext->numSessions), 1, memory_order_relaxed);
+    removeRemoteSession(
+      proxyContext->remoteSelector,
+      getRemoteAddrInfoIndex(proxyContext,
+                             getConnectionPair(connectionSocketInfo)));
+    if (listenRateLimit != NULL)
+    {
+      --(listenRateLimit->numSessions);
+    }
+  }
+
+  if (relatedConnectionSocketInfo != NULL)
+  {
+    relatedConnectionSocketInfo->relatedConnectionSocketInfo = NULL;
+  }
+  else
+  {
+    freeObjectPoolObject(proxyContext->connectionPairPool,
+                         getConnectionPair(connectionSocketInfo));
+  }
+}
+
+static void destroyMarkedConnections(
+  struct ProxyContext* proxyContext)
+{
+  struct ConnectionSocketInfo* connectionSocketInfo;
+
+  if (TAILQ_EMPTY(proxyContext->destroyedList))
+  {
+    return;
+  }
+
+  /* one flush for all removals before any of the sockets are closed */
+  TAILQ_FOREACH(connectionSocketInfo, proxyContext->destroyedList, entry)
+  {
+    /* SO_SPLICE keeps the count in the socket, save it for the
+       disconnect message of the other half too */
+    connectionSocketInfo->bytesRelayed =
+      getBytesTransferred(proxyContext, connectionSocketInfo);
+    removeConnectionSocketInfoFromPollState(proxyContext, connectionSocketInfo);
+    if (connectionSocketInfo->type == PROXY_TO_REMOTE)
+    {
+      removeRaceConnectFromPollState(
+        proxyContext,
+        &(getConnectionPair(connectionSocketInfo)->raceConnectInfo));
+    }
+  }
+  flushPollState(proxyContext->pollState);
+
+  while ((connectionSocketInfo =
+          removeFirstFromTAILQ(proxyContext->destroyedList)) != NULL)
+  {
+    destroyConnection(proxyContext, connectionSocketInfo);
+  }
+
+  /* the sessions just ended may have made room for waiting clients */
+  drainPendingClients(proxyContext);
+}
+
+/*
+ * The peer of connectionSocketInfo will send no more data, pass its FIN
+ * on to the related socket.  Returns the socket to disconnect once both
+ * directions have finished or on error, otherwise NULL.
+ */
+static struct ConnectionSocketInfo* finishRelayDirection(
+  struct ConnectionSocketInfo* connectionSocketInfo,
+  struct ProxyContext* proxyContext)
+{
+  struct ConnectionSocketInfo* relatedConnectionSocketInfo =
+    connectionSocketInfo->relatedConnectionSocketInfo;
+
+  connectionSocketInfo->readFinished = true;
+  setWaitingForRead(proxyContext, connectionSocketInfo, false);
+
+  if (!shutdownSocketWrite(relatedConnectionSocketInfo->socket))
+  {
+    proxyLog("shutdown write error fd %d errno %d: %s",
+             relatedConnectionSocketInfo->socket,
+             errno,
+             errnoToString(errno));
+    return connectionSocketInfo;
+  }
+
+  if (relatedConnectionSocketInfo->readFinished)
+  {
+    return connectionSocketInfo;
+  }
+  return NULL;
+}
+
+/*
+ * OpenBSD dissolves a splice when its source socket reaches EOF or an
+ * error, which makes the source readable again.  A clean EOF finishes
+ * the direction, anything else ends the session.
+ */
+static struct ConnectionSocketInfo* handleSpliceDissolved(
+  struct ConnectionSocketInfo* connectionSocketInfo,
+  struct ProxyContext* proxyContext,
+  const int socketError)
+{
+  if ((socketError == 0) &&
+      (!isSocketPeerOpen(connectionSocketInfo->socket)))
+  {
+    return finishRelayDirection(connectionSocketInfo, proxyContext);
+  }
+
+  proxyLog("splice read error fd %d errno %d: %s",
+           connectionSocketInfo->socket,
+           socketError,
+           errnoToString(socketError));
+  return connectionSocketInfo;
+}
+
+/* The most of maxBytes that the socket's buckets allow to be read now. */
+static size_t getRelayReadLimit(
+  const struct ProxyContext* proxyContext,
+  const struct ConnectionSocketInfo* connectionSocketInfo,
+  size_t maxBytes)
+{
+  const struct TokenBucket* listenTokenBucket =
+    connectionSocketInfo->listenTokenBucket;
+
+  if ((proxyContext->proxySettings->sessionBytesPerSecond > 0) &&
+      (getTokenBucketTokens(&(connectionSocketInfo->tokenBucket)) <
+       maxBytes))
+  {
+    maxBytes = getTokenBucketTokens(&(connectionSocketInfo->tokenBucket));
+  }
+
+  if ((listenTokenBucket != NULL) &&
+      (getTokenBucketTokens(listenTokenBucket) < maxBytes))
+  {
+    maxBytes = getTokenBucketTokens(listenTokenBucket);
+  }
+
+  return maxBytes;
+}
+
+static void takeRelayTokens(
+  const struct ProxyContext* proxyContext,
+  struct ConnectionSocketInfo* connectionSocketInfo,
+  size_t numBytes)
+{
+  struct TokenBucket* listenTokenBucket =
+    connectionSocketInfo->listenTokenBucket;
+
+  if (proxyContext->proxySettings->sessionBytesPerSecond > 0)
+  {
+    takeTokenBucketTokens(&(connectionSocketInfo->tokenBucket), numBytes);
+  }
+
+  if (listenTokenBucket != NULL)
+  {
+    takeTokenBucketTokens(listenTokenBucket, numBytes);
+  }
+}
+
+/* Reading resumes on the next refill. */
+static void pauseRelayForRateLimit(
+  struct ProxyContext* proxyContext,
+  struct ConnectionSocketInfo* connectionSocketInfo)
+{
+  connectionSocketInfo->rateLimited = true;
+  setWaitingForRead(proxyContext, connectionSocketInfo, false);
+}
+
+/* Takes tokens for the bytes the active splice moved since it was last
+   charged and returns all the bytes it moved. */
+static off_t chargeActiveSplice(
+  const struct ProxyContext* proxyContext,
+  struct ConnectionSocketInfo* connectionSocketInfo)
+{
+  const off_t splicedBytes =
+    getSpliceBytesTransferred(connectionSocketInfo->socket);
+
+  if (splicedBytes > connectionSocketInfo->spliceBytesCharged)
+  {
+    takeRelayTokens(proxyContext, connectionSocketInfo,
+                    splicedBytes - connectionSocketInfo->spliceBytesCharged);
+    connectionSocketInfo->spliceBytesCharged = splicedBytes;
+  }
+
+  return splicedBytes;
+}
+
+/* A splice is only charged as it moves bytes, so with a listen address
+   limit it gets at most an even share of one refill.  Otherwise idle
+   sessions could splice past what the other sessions there are left. */
+static size_t getSpliceMaxBytes(
+  const struct ProxyContext* proxyContext,
+  const struct ConnectionSocketInfo* connectionSocketInfo)
+{
+  const struct ListenRateLimit* listenRateLimit =
+    getConnectionPair(connectionSocketInfo)->listenRateLimit;
+  size_t maxBytes =
+    getRelayReadLimit(proxyContext, connectionSocketInfo, SIZE_MAX);
+
+  if ((listenRateLimit != NULL) && (maxBytes > 0))
+  {
+    uint64_t shareBytes =
+      getTokenBucketTokensPerRefill(connectionSocketInfo->listenTokenBucket) /
+      listenRateLimit->numSessions;
+    if (shareBytes == 0)
+    {
+      shareBytes = 1;
+    }
+    if (shareBytes < maxBytes)
+    {
+      maxBytes = shareBytes;
+    }
+  }
+
+  return maxBytes;
+}
+
+/*
+ * SO_SPLICE with rate limits.  The socket is readable once its last
+ * splice dissolved, or with no splice in place when it has data or an
+ * EOF.  A splice that reached its maximum dissolves with EFBIG and is
+ * set up again if the buckets allow.
+ */
+static struct ConnectionSocketInfo* relayFromSocketThroughRateLimitedSplice(
+  struct ConnectionSocketInfo* connectionSocketInfo,
+  struct ProxyContext* proxyContext)
+{
+  int socketError = getSocketError(connectionSocketInfo->socket);
+  size_t maxBytes;
+
+  if (connectionSocketInfo->spliceActive)
+  {
+    connectionSocketInfo->bytesRelayed +=
+      chargeActiveSplice(proxyContext, connectionSocketInfo);
+    connectionSocketInfo->spliceActive = false;
+    if (socketError == EFBIG)
+    {
+      socketError = 0;
+    }
+  }
+
+  if ((socketError != 0) ||
+      (!isSocketPeerOpen(connectionSocketInfo->socket)))
+  {
+    return handleSpliceDissolved(connectionSocketInfo, proxyContext,
+                                 socketError);
+  }
+
+  maxBytes = getSpliceMaxBytes(proxyContext, connectionSocketInfo);
+  if (maxBytes == 0)
+  {
+    pauseRelayForRateLimit(proxyContext, connectionSocketInfo);
+    return NULL;
+  }
+
+  /* a session with no bucket of its own is spliced with no maximum */
+  if (!setSocketSpliceMax(
+         connectionSocketInfo->socket,
+         connectionSocketInfo->relatedConnectionSocketInfo->socket,
+         ((maxBytes == SIZE_MAX) ? 0 : (off_t)maxBytes)))
+  {
+    proxyLog("splice setup error fd %d errno %d: %s",
+             connectionSocketInfo->socket,
+             errno,
+             errnoToString(errno));
+    return connectionSocketInfo;
+  }
+
+  connectionSocketInfo->spliceActive = true;
+  connectionSocketInfo->spliceBytesCharged = 0;
+  return NULL;
+}
+
+static void releaseRelayBuffer(
+  struct ProxyContext* proxyContext,
+  struct ConnectionSocketInfo* connectionSocketInfo)
+{
+  freeObjectPoolObject(proxyContext->relayBufferPool,
+                       connectionSocketInfo->relayBuffer);
+  connectionSocketInfo->relayBuffer = NULL;
+}
+
+/*
+ * Writes what connectionSocketInfo has buffered to the related socket.
+ * Returns false on a write error.
+ */
+static bool flushRelayBuffer(
+  struct ConnectionSocketInfo* connectionSocketInfo,
+  struct ProxyContext* proxyContext)
+{
+  struct ConnectionSocketInfo* relatedConnectionSocketInfo =
+    connectionSocketInfo->relatedConnectionSocketInfo;
+  struct RelayBuffer* relayBuffer = connectionSocketInfo->relayBuffer;
+
+  while (relayBuffer->startOffset < relayBuffer->endOffset)
+  {
+    size_t bytesWritten;
+    const enum SocketIOResult socketIOResult =
+      writeSocket(relatedConnectionSocketInfo->socket,
+                  relayBuffer->data + relayBuffer->startOffset,
+                  relayBuffer->endOffset - relayBuffer->startOffset,
+                  &bytesWritten);
+
+    if (socketIOResult == SOCKET_IO_RESULT_WOULD_BLOCK)
+    {
+      setWaitingForRead(proxyContext, connectionSocketInfo, false);
+      setWaitingForWrite(proxyContext, relatedConnectionSocketInfo, true);
+      return true;
+    }
+    else if (socketIOResult != SOCKET_IO_RESULT_SUCCESS)
+    {
+      proxyLog("relay write error fd %d errno %d: %s",
+               relatedConnectionSocketInfo->socket,
+               errno,
+               errnoToString(errno));
+      return false;
+    }
+
+    relayBuffer->startOffset += bytesWritten;
+    connectionSocketInfo->bytesRelayed += bytesWritten;
+  }
+
+  releaseRelayBuffer(proxyContext, connectionSocketInfo);
+  setWaitingForWrite(proxyContext, relatedConnectionSocketInfo, false);
+  setWaitingForRead(proxyContext, connectionSocketInfo, true);
+  return true;
+}
+
+/* Relays until the socket has nothing more to read, the related socket
+   stops taking data, or MAX_OPERATIONS_FOR_ONE_FD buffers were moved. */
+static struct ConnectionSocketInfo* relayFromSocket(
+  struct ConnectionSocketInfo* connectionSocketInfo,
+  struct ProxyContext* proxyContext)
+{
+  int i;
+
+  for (i = 0;
+       connectionSocketInfo->waitingForRead &&
+       (i < MAX_OPERATIONS_FOR_ONE_FD);
+       ++i)
+  {
+    const size_t readLimit =
+      getRelayReadLimit(proxyContext, connectionSocketInfo, RELAY_BUFFER_SIZE);
+    struct RelayBuffer* relayBuffer;
+    enum SocketIOResult socketIOResult;
+    size_t bytesRead;
+
+    if (readLimit == 0)
+    {
+      pauseRelayForRateLimit(proxyContext, connectionSocketInfo);
+      break;
+    }
+
+    relayBuffer =
+      allocateUninitializedObjectPoolObject(proxyContext->relayBufferPool);
+    connectionSocketInfo->relayBuffer = relayBuffer;
+
+    socketIOResult = readSocket(connectionSocketInfo->socket,
+                                relayBuffer->data,
+                                readLimit,
+                                &bytesRead);
+    if (socketIOResult != SOCKET_IO_RESULT_SUCCESS)
+    {
+      releaseRelayBuffer(proxyContext, connectionSocketInfo);
+      if (socketIOResult == SOCKET_IO_RESULT_WOULD_BLOCK)
+      {
+        break;
+      }
+      else if (socketIOResult == SOCKET_IO_RESULT_EOF)
+      {
+        return finishRelayDirection(connectionSocketInfo, proxyContext);
+      }
+      proxyLog("relay read error fd %d errno %d: %s",
+               connectionSocketInfo->socket,
+               errno,
+               errnoToString(errno));
+      return connectionSocketInfo;
+    }
+
+    takeRelayTokens(proxyContext, connectionSocketInfo, bytesRead);
+    relayBuffer->startOffset = 0;
+    relayBuffer->endOffset = bytesRead;
+
+    if (!flushRelayBuffer(connectionSocketInfo, proxyContext))
+    {
+      return connectionSocketInfo;
+    }
+  }
+
+  return NULL;
+}
+
+static void releaseRelayPipe(
+  struct ProxyContext* proxyContext,
+  struct ConnectionSocketInfo* connectionSocketInfo)
+{
+  returnPipePoolPipe(proxyContext->relayPipePool,
+                     connectionSocketInfo->relayPipeFDArray);
+  connectionSocketInfo->holdingRelayPipe = false;
+}
+
+/*
+ * Splices what connectionSocketInfo has in its pipe to the related
+ * socket.  Returns false on a splice error.
+ */
+static bool flushRelayPipe(
+  struct ConnectionSocketInfo* connectionSocketInfo,
+  struct ProxyContext* proxyContext)
+{
+  struct ConnectionSocketInfo* relatedConnectionSocketInfo =
+    connectionSocketInfo->relatedConnectionSocketInfo;
+
+  while (connectionSocketInfo->relayPipeBytes > 0)
+  {
+    size_t bytesSpliced;
+    const enum SocketIOResult socketIOResult =
+      spliceSocket(connectionSocketInfo->relayPipeFDArray[0],
+                   relatedConnectionSocketInfo->socket,
+                   connectionSocketInfo->relayPipeBytes,
+                   &bytesSpliced);
+
+    if (socketIOResult == SOCKET_IO_RESULT_WOULD_BLOCK)
+    {
+      setWaitingForRead(proxyContext, connectionSocketInfo, false);
+      setWaitingForWrite(proxyContext, relatedConnectionSocketInfo, true);
+      return true;
+    }
+    else if (socketIOResult != SOCKET_IO_RESULT_SUCCESS)
+    {
+      proxyLog("relay splice write error fd %d errno %d: %s",
+               relatedConnectionSocketInfo->socket,
+               errno,
+               errnoToString(errno));
+      return false;
+    }
+
+    connectionSocketInfo->relayPipeBytes -= bytesSpliced;
+    connectionSocketInfo->bytesRelayed += bytesSpliced;
+  }
+
+  releaseRelayPipe(proxyContext, connectionSocketInfo);
+  setWaitingForWrite(proxyContext, relatedConnectionSocketInfo, false);
+  setWaitingForRead(proxyContext, connectionSocketInfo, true);
+  return true;
+}
+
+/* relayFromSocket() for -z pipe. */
+static struct ConnectionSocketInfo* relayFromSocketThroughPipe(
+  struct ConnectionSocketInfo* connectionSocketInfo,
+  struct ProxyContext* proxyContext)
+{
+  int i;
+
+  for (i = 0;
+       connectionSocketInfo->waitingForRead &&
+       (i < MAX_OPERATIONS_FOR_ONE_FD);
+       ++i)
+  {
+    const size_t readLimit =
+      getRelayReadLimit(proxyContext, connectionSocketInfo, RELAY_PIPE_SIZE);
+    enum SocketIOResult socketIOResult;
+    size_t bytesSpliced;
+
+    if (readLimit == 0)
+    {
+      pauseRelayForRateLimit(proxyContext, connectionSocketInfo);
+      break;
+    }
+
+    if (!takePipePoolPipe(proxyContext->relayPipePool,
+                          connectionSocketInfo->relayPipeFDArray))
+    {
+      proxyLog("relay pipe error errno %d: %s",
+               errno,
+               errnoToString(errno));
+      return connectionSocketInfo;
+    }
+    connectionSocketInfo->holdingRelayPipe = true;
+
+    socketIOResult = spliceSocket(connectionSocketInfo->socket,
+                                  connectionSocketInfo->relayPipeFDArray[1],
+                                  readLimit,
+                                  &bytesSpliced);
+    if (socketIOResult != SOCKET_IO_RESULT_SUCCESS)
+    {
+      releaseRelayPipe(proxyContext, connectionSocketInfo);
+      if (socketIOResult == SOCKET_IO_RESULT_WOULD_BLOCK)
+      {
+        break;
+      }
+      else if (socketIOResult == SOCKET_IO_RESULT_EOF)
+      {
+        return finishRelayDirection(connectionSocketInfo, proxyContext);
+      }
+      proxyLog("relay splice read error fd %d errno %d: %s",
+               connectionSocketInfo->socket,
+               errno,
+               errnoToString(errno));
+      return connectionSocketInfo;
+    }
+
+    takeRelayTokens(proxyContext, connectionSocketInfo, bytesSpliced);
+    connectionSocketInfo->relayPipeBytes = bytesSpliced;
+
+    if (!flushRelayPipe(connectionSocketInfo, proxyContext))
+    {
+      return connectionSocketInfo;
+    }
+  }
+
+  return NULL;
+}
+
+static struct ConnectionSocketInfo* handleConnectionReadyForRead(
+  struct ConnectionSocketInfo* connectionSocketInfo,
+  struct ProxyContext* proxyContext)
+{
+  struct ConnectionSocketInfo* disconnectSocketInfo = NULL;
+
+  if (!connectionSocketInfo->waitingForRead)
+  {
+    /* reading was paused earlier in this batch */
+  }
+  else if (proxyContext->proxySettings->relayMode == RELAY_COPY)
+  {
+    disconnectSocketInfo =
+      relayFromSocket(connectionSocketInfo, proxyContext);
+  }
+  else if (proxyContext->proxySettings->relayMode == RELAY_PIPE)
+  {
+    disconnectSocketInfo =
+      relayFromSocketThroughPipe(connectionSocketInfo, proxyContext);
+  }
+  else if (proxyContext->rateLimitInfo != NULL)
+  {
+    disconnectSocketInfo =
+      relayFromSocketThroughRateLimitedSplice(connectionSocketInfo,
+                                              proxyContext);
+  }
+  else
+  {
+    disconnectSocketInfo =
+      handleSpliceDissolved(connectionSocketInfo, proxyContext,
+                            getSocketError(connectionSocketInfo->socket));
+  }
+
+  return disconnectSocketInfo;
+}
+
+/*
+ * The race connect takes over the remote half, whose own socket is
+ * closed.  The race socket must already be removed from the PollState.
+ */
+static void promoteRaceConnect(
+  struct ProxyContext* proxyContext,
+  struct ConnectionPair* connectionPair,
+  bool connected)
+{
+  struct ConnectionSocketInfo* clientConnectionSocketInfo =
+    &(connectionPair->clientConnectionSocketInfo);
+  struct ConnectionSocketInfo* remoteConnectionSocketInfo =
+    &(connectionPair->remoteConnectionSocketInfo);
+  struct RaceConnectInfo* raceConnectInfo = &(connectionPair->raceConnectInfo);
+
+  removeConnectionSocketInfoFromPollState(
+    proxyContext, remoteConnectionSocketInfo);
+  flushPollState(proxyContext->pollState);
+  signalSafeClose(remoteConnectionSocketInfo->socket);
+
+  removeRemoteSession(proxyContext->remoteSelector,
+                      getRemoteAddrInfoIndex(proxyContext, connectionPair));
+  connectionPair->remoteAddrInfo = raceConnectInfo->remoteAddrInfo;
+  connectionPair->connectStartTimeUS = raceConnectInfo->connectStartTimeUS;
+  addRemoteSession(proxyContext->remoteSelector,
+                   getRemoteAddrInfoIndex(proxyContext, connectionPair));
+
+  remoteConnectionSocketInfo->socket = raceConnectInfo->socket;
+  raceConnectInfo->socket = -1;
+
+  if (connected)
+  {
+    remoteConnectionSocketInfo->waitingForConnect = false;
+    remoteConnectionSocketInfo->waitingForRead = true;
+    clientConnectionSocketInfo->waitingForRead = true;
+    addConnectionSocketInfoToPollState(
+      proxyContext, clientConnectionSocketInfo);
+  }
+
+  if (!proxyContext->proxySettings->quiet)
+  {
+    printConnectMessage(
+      (connected ?
+       "connect race won proxy to remote" :
+       "connect race continuing proxy to remote"),
+      remoteConnectionSocketInfo);
+  }
+
+  addConnectionSocketInfoToPollState(
+    proxyContext, remoteConnectionSocketInfo);
+}
+
+static void startRaceConnect(
+  struct ProxyContext* proxyContext,
+  struct ConnectionPair* connectionPair)
+{
+  struct RaceConnectInfo* raceConnectInfo = &(connectionPair->raceConnectInfo);
+  const uint64_t connectStartTimeUS = getMonotonicTimeUS();
+  const struct RemoteAddrInfo* remoteAddrInfo =
+    chooseRemoteAddrInfo(proxyContext, connectionPair,
+                         getRemoteAddrInfoIndex(proxyContext, connectionPair));
+  struct RemoteSocketResult remoteSocketResult;
+
+  if ((remoteAddrInfo == NULL) ||
+      (remoteAddrInfo == connectionPair->remoteAddrInfo))
+  {
+    return;
+  }
+
+  remoteSocketResult =
+    createRemoteSocket(proxyContext,
+                       connectionPair->clientConnectionSocketInfo.socket,
+                       remoteAddrInfo);
+  if (remoteSocketResult.status == REMOTE_SOCKET_ERROR)
+  {
+    if (!remoteSocketResult.localError)
+    {
+      addRemoteConnectResultSample(
+        proxyContext,
+        remoteAddrInfo - proxyContext->proxySettings->remoteAddrInfoArray,
+        connectStartTimeUS, false);
+    }
+    return;
+  }
+
+  raceConnectInfo->socket = remoteSocketResult.remoteSocket;
+  raceConnectInfo->remoteAddrInfo = remoteAddrInfo;
+  raceConnectInfo->connectStartTimeUS = connectStartTimeUS;
+
+  if (remoteSocketResult.status == REMOTE_SOCKET_CONNECTED)
+  {
+    addRemoteConnectResultSample(
+      proxyContext,
+      remoteAddrInfo - proxyContext->proxySettings->remoteAddrInfoArray,
+      connectStartTimeUS, true);
+    promoteRaceConnect(proxyContext, connectionPair, true);
+    return;
+  }
+
+  if (!proxyContext->proxySettings->quiet)
+  {
+    proxyLog("connect race starting proxy to remote %s:%s (fd=%d)",
+             remoteAddrInfo->addrPortStrings.addrString,
+             remoteAddrInfo->addrPortStrings.portString,
+             raceConnectInfo->socket);
+  }
+
+  addPollFDForWrite(
+    proxyContext->pollState,
+    raceConnectInfo->socket,
+    raceConnectInfo);
+}
+
+static void handleRaceConnectReady(
+  struct AbstractReadyEventHandler* abstractReadyEventHandler,
+  const struct ReadyEventInfo* readyEventInfo,
+  struct ProxyContext* proxyContext)
+{
+  struct RaceConnectInfo* raceConnectInfo =
+    (struct RaceConnectInfo*) abstractReadyEventHandler;
+  struct ConnectionPair* connectionPair =
+    getRaceConnectionPair(raceConnectInfo);
+  struct ConnectionSocketInfo* remoteConnectionSocketInfo =
+    &(connectionPair->remoteConnectionSocketInfo);
+  size_t raceRemoteIndex;
+  int socketError;
+
+  if (remoteConnectionSocketInfo->markedForDestruction)
+  {
+    return;
+  }
+
+  if (isReadyEventForTimeout(readyEventInfo))
+  {
+    if (raceConnectInfo->waitingForDelay &&
+        (!isPollTimerActive(&(raceConnectInfo->delayTimer))))
+    {
+      raceConnectInfo->waitingForDelay = false;
+      if (remoteConnectionSocketInfo->waitingForConnect)
+      {
+        startRaceConnect(proxyContext, connectionPair);
+      }
+    }
+    return;
+  }
+
+  /* a write event queued behind a race that already ended is ignored */
+  if ((!isReadyEventForWrite(readyEventInfo)) ||
+      (raceConnectInfo->socket == -1))
+  {
+    return;
+  }
+
+  socketError = getSocketError(raceConnectInfo->socket);
+  if (socketError == EINPROGRESS)
+  {
+    return;
+  }
+
+  raceRemoteIndex =
+    raceConnectInfo->remoteAddrInfo -
+    proxyContext->proxySettings->remoteAddrInfoArray;
+
+  if (socketError != 0)
+  {
+    proxyLog("async race connect fd %d errno %d: %s",
+             raceConnectInfo->socket,
+             socketError,
+             errnoToString(socketError));
+    addRemoteConnectResultSample(proxyContext, raceRemoteIndex,
+                                 raceConnectInfo->connectStartTimeUS, false);
+    stopRaceConnect(proxyContext, raceConnectInfo);
+    return;
+  }
+
+  addRemoteConnectResultSample(proxyContext, raceRemoteIndex,
+                               raceConnectInfo->connectStartTimeUS, true);
+
+  if (!setupRelay(
+         proxyContext,
+         raceConnectInfo->socket,
+         connectionPair->clientConnectionSocketInfo.socket))
+  {
+    proxyLog("splice setup error");
+    markForDestruction(remoteConnectionSocketInfo, proxyContext);
+    return;
+  }
+
+  removePollFDForWrite(proxyContext->pollState, raceConnectInfo->socket);
+  promoteRaceConnect(proxyContext, connectionPair, true);
+}
+
+/*
+ * After a failed connect of the remote half the client keeps waiting
+ * while another remote is tried, as long as the session has retries left.
+ * Returns false if no new connect was started.
+ */
+static bool retryRemoteConnect(
+  struct ConnectionSocketInfo* connectionSocketInfo,
+  struct ProxyContext* proxyContext)
+{
+  struct ConnectionSocketInfo* relatedConnectionSocketInfo =
+    connectionSocketInfo->relatedConnectionSocketInfo;
+  struct ConnectionPair* connectionPair =
+    getConnectionPair(connectionSocketInfo);
+  const size_t failedRemoteIndex =
+    getRemoteAddrInfoIndex(proxyContext, connectionPair);
+  struct RaceConnectInfo* raceConnectInfo = &(connectionPair->raceConnectInfo);
+  struct RemoteSocketResult remoteSocketResult;
+
+  /* a race connect in progress takes over without using a retry */
+  if (raceConnectInfo->socket != -1)
+  {
+    removePollFDForWrite(proxyContext->pollState, raceConnectInfo->socket);
+    promoteRaceConnect(proxyContext, connectionPair, false);
+    return true;
+  }
+  removeRaceConnectFromPollState(proxyContext, raceConnectInfo);
+
+  if (connectionPair->numConnectRetries >=
+      proxyContext->proxySettings->connectRetries)
+  {
+    return false;
+  }
+  ++(connectionPair->numConnectRetries);
+
+  remoteSocketResult =
+    connectToRemote(proxyContext, connectionPair, failedRemoteIndex);
+  if ((remoteSocketResult.status == REMOTE_SOCKET_ERROR) ||
+      (remoteSocketResult.status == REMOTE_SOCKET_ALL_FULL))
+  {
+    return false;
+  }
+
+  removeRemoteSession(proxyContext->remoteSelector, failedRemoteIndex);
+  addRemoteSession(proxyContext->remoteSelector,
+                   getRemoteAddrInfoIndex(proxyContext, connectionPair));
+
+  removeConnectionSocketInfoFromPollState(proxyContext, connectionSocketInfo);
+  flushPollState(proxyContext->pollState);
+  signalSafeClose(connectionSocketInfo->socket);
+  connectionSocketInfo->socket = remoteSocketResult.remoteSocket;
+
+  if (remoteSocketResult.status == REMOTE_SOCKET_CONNECTED)
+  {
+    if (!remoteSocketResult.fromWarmPool)
+    {
+      addConnectResult(proxyContext, connectionSocketInfo, true);
+    }
+    connectionSocketInfo->waitingForConnect = false;
+    connectionSocketInfo->waitingForRead = true;
+    relatedConnectionSocketInfo->waitingForRead = true;
+    addConnectionSocketInfoToPollState(
+      proxyContext, relatedConnectionSocketInfo);
+  }
+
+  if (!proxyContext->proxySettings->quiet)
+  {
+    printConnectMessage(
+      (remoteSocketResult.fromWarmPool ?
+       "connect retry warm proxy to remote" :
+       ((remoteSocketResult.status == REMOTE_SOCKET_CONNECTED) ?
+        "connect retry complete proxy to remote" :
+        "connect retry starting proxy to remote")),
+      connectionSocketInfo);
+  }
+
+  addConnectionSocketInfoToPollState(proxyContext, connectionSocketInfo);
+
+  if (connectionSocketInfo->waitingForConnect)
+  {
+    startRaceConnectDelay(proxyContext, connectionPair);
+  }
+
+  return true;
+}
+
+static struct ConnectionSocketInfo* handleConnectionReadyForWrite(
+  struct ConnectionSocketInfo* connectionSocketInfo,
+  struct ProxyContext* proxyContext)
+{
+  struct ConnectionSocketInfo* relatedConnectionSocketInfo =
+    connectionSocketInfo->relatedConnectionSocketInfo;
+
+  if (connectionSocketInfo->waitingForConnect)
+  {
+    const int socketError = getSocketError(connectionSocketInfo->socket);
+    if (socketError == EINPROGRESS)
+    {
+      /* do nothing, still in progress */
+    }
+    else if (socketError != 0)
+    {
+      proxyLog("async remote connect fd %d errno %d: %s",
+               connectionSocketInfo->socket,
+               socketError,
+               errnoToString(socketError));
+      addConnectResult(proxyContext, connectionSocketInfo, false);
+      if (!retryRemoteConnect(connectionSocketInfo, proxyContext))
+      {
+        goto fail;
+      }
+    }
+    else
+    {
+      addConnectResult(proxyContext, connectionSocketInfo, true);
+
+      stopRaceConnect(proxyContext,
+                      &(getConnectionPair(connectionSocketInfo)->
+                        raceConnectInfo));
+
+      if (!proxyContext->proxySettings->quiet)
+      {
+        printConnectMessage("connect complete proxy to remote",
+                            connectionSocketInfo);
+      }
+
+      if (!setupRelay(
+             proxyContext,
+             connectionSocketInfo->socket,
+             relatedConnectionSocketInfo->socket))
+      {
+        proxyLog("splice setup error");
+        goto fail;
+      }
+
+      removeConnectionSocketInfoFromPollState(
+        proxyContext, connectionSocketInfo);
+      removeConnectionSocketInfoFromPollState(
+        proxyContext, relatedConnectionSocketInfo);
+
+      connectionSocketInfo->waitingForConnect = false;
+      connectionSocketInfo->waitingForRead = true;
+      addConnectionSocketInfoToPollState(
+        proxyContext, connectionSocketInfo);
+
+      relatedConnectionSocketInfo->waitingForConnect = false;
+      relatedConnectionSocketInfo->waitingForRead = true;
+      addConnectionSocketInfoToPollState(
+        proxyContext, relatedConnectionSocketInfo);
+    }
+  }
+  else if (connectionSocketInfo->waitingForWrite)
+  {
+    /* the related socket's buffer or pipe was waiting for room in this one */
+    const bool flushed =
+      (proxyContext->proxySettings->relayMode == RELAY_PIPE) ?
+      flushRelayPipe(relatedConnectionSocketInfo, proxyContext) :
+      flushRelayBuffer(relatedConnectionSocketInfo, proxyContext);
+    if (!flushed)
+    {
+      goto fail;
+    }
+  }
+
+  return NULL;
+
+fail:
+  return connectionSocketInfo;
+}
+
+static struct ConnectionSocketInfo* handleConnectionReadyForTimeout(
+  struct ConnectionSocketInfo* connectionSocketInfo,
+  struct ProxyContext* proxyContext)
+{
+  struct ConnectionSocketInfo* disconnectSocketInfo = NULL;
+
+  /* an active timer belongs to a retry started after this timeout fired */
+  if (connectionSocketInfo->waitingForConnect &&
+      (!isPollTimerActive(&(connectionSocketInfo->connectTimer))))
+  {
+    proxyLog("connect timeout fd %d", connectionSocketInfo->socket);
+    addConnectResult(proxyContext, connectionSocketInfo, false);
+    if (!retryRemoteConnect(connectionSocketInfo, proxyContext))
+    {
+      disconnectSocketInfo = connectionSocketInfo;
+    }
+  }
+
+  return disconnectSocketInfo;
+}
+
+static void handleConnectionSocketReady(
   struct AbstractReadyEventHandler* abstractReadyEventHandler,
   const struct ReadyEventInfo* readyEventInfo,
   struct ProxyContext* proxyContext)
@@ -630,9 +2787,9 @@ static void handleConnectionSocketReady(
   proxyLog("fd %d readyForRead %d readyForWrite %d readyForTimeout %d "
            "markedForDestruction %d",
            connectionSocketInfo->socket,
-           readyEventInfo->readyForRead,
-           readyEventInfo->readyForWrite,
-           readyEventInfo->readyForTimeout,
+           isReadyEventForRead(readyEventInfo),
+           isReadyEventForWrite(readyEventInfo),
+           isReadyEventForTimeout(readyEventInfo),
            connectionSocketInfo->markedForDestruction);
 #endif
 
@@ -641,7 +2798,7 @@ static void handleConnectionSocketReady(
     disconnectSocketInfo = connectionSocketInfo;
   }
 
-  if (readyEventInfo->readyForRead &&
+  if (isReadyEventForRead(readyEventInfo) &&
       (disconnectSocketInfo == NULL))
   {
     disconnectSocketInfo =
@@ -650,7 +2807,7 @@ static void handleConnectionSocketReady(
         proxyContext);
   }
 
-  if (readyEventInfo->readyForWrite &&
+  if (isReadyEventForWrite(readyEventInfo) &&
       (disconnectSocketInfo == NULL))
   {
     disconnectSocketInfo =
@@ -659,7 +2816,7 @@ static void handleConnectionSocketReady(
         proxyContext);
   }
 
-  if (readyEventInfo->readyForTimeout &&
+  if (isReadyEventForTimeout(readyEventInfo) &&
       (disconnectSocketInfo == NULL))
   {
     disconnectSocketInfo =
@@ -684,32 +2841,480 @@ static void handleServerSocketReady(
   enum AcceptSocketResult acceptSocketResult = ACCEPT_SOCKET_RESULT_SUCCESS;
   int i;
 
-  for (i = 0;
-       (acceptSocketResult == ACCEPT_SOCKET_RESULT_SUCCESS) &&
-       (i < MAX_OPERATIONS_FOR_ONE_FD);
-       ++i)
+  for (i = 0;
+       (acceptSocketResult == ACCEPT_SOCKET_RESULT_SUCCESS) &&
+       (i < MAX_OPERATIONS_FOR_ONE_FD);
+       ++i)
+  {
+    int acceptedFD;
+    struct SockAddrInfo clientSockAddrInfo;
+
+    acceptSocketResult = acceptSocket(
+      serverSocketInfo->socket,
+      &acceptedFD,
+      &clientSockAddrInfo);
+
+    if (acceptSocketResult == ACCEPT_SOCKET_RESULT_ERROR)
+    {
+      proxyLog("accept error errno %d: %s", errno, errnoToString(errno));
+    }
+    else if (acceptSocketResult == ACCEPT_SOCKET_RESULT_SUCCESS)
+    {
+      if (!proxyContext->proxySettings->quiet)
+      {
+        proxyLog("accept fd %d", acceptedFD);
+      }
+      (*(serverSocketInfo->handleClientSocketFunction))(
+        acceptedFD,
+        &clientSockAddrInfo,
+        serverSocketInfo->listenAddrInfo,
+        proxyContext);
+    }
+  }
+}
+
+static void wakeupHandoffQueue(
+  struct HandoffQueueInfo* handoffQueueInfo)
+{
+  if (!atomic_exchange(&(handoffQueueInfo->wakeupPending), true))
+  {
+    const char wakeupByte = 0;
+    ssize_t retVal;
+    do
+    {
+      retVal = write(handoffQueueInfo->wakeupWriteFD, &wakeupByte, 1);
+    } while ((retVal == -1) && (errno == EINTR));
+    /* EAGAIN means the pipe already holds a wakeup */
+  }
+}
+
+static size_t getWorkerLoad(
+  const struct ProxyContext* workerContext)
+{
+  return (atomic_load_explicit(
+            (atomic_size_t*)&(workerContext->numSessions),
+            memory_order_relaxed) +
+          getSPSCRingSize(workerContext->handoffQueueInfo->spscRing));
+}
+
+static bool pushHandoffSocketInfo(
+  struct ProxyContext* workerContext,
+  const struct HandoffSocketInfo* handoffSocketInfo)
+{
+  struct HandoffQueueInfo* handoffQueueInfo = workerContext->handoffQueueInfo;
+
+  if (!pushSPSCRing(handoffQueueInfo->spscRing, handoffSocketInfo))
+  {
+    return false;
+  }
+
+  wakeupHandoffQueue(handoffQueueInfo);
+
+  return true;
+}
+
+/* Runs on the acceptor thread, hands the client to the least loaded worker. */
+static void handoffClientSocket(
+  const int clientSocket,
+  const struct SockAddrInfo* clientSockAddrInfo,
+  const struct ListenAddrInfo* listenAddrInfo,
+  struct ProxyContext* proxyContext)
+{
+  struct HandoffSocketInfo handoffSocketInfo;
+  struct ProxyContext* bestWorkerContext = NULL;
+  size_t bestLoad = SIZE_MAX;
+  uint32_t i;
+
+  handoffSocketInfo.socket = clientSocket;
+  memcpy(&(handoffSocketInfo.clientSockAddrInfo),
+         clientSockAddrInfo,
+         sizeof(struct SockAddrInfo));
+  handoffSocketInfo.listenAddrInfo = listenAddrInfo;
+
+  for (i = 0; i < proxyContext->numWorkerContexts; ++i)
+  {
+    const size_t load = getWorkerLoad(proxyContext->workerContextArray[i]);
+    if (load < bestLoad)
+    {
+      bestLoad = load;
+      bestWorkerContext = proxyContext->workerContextArray[i];
+    }
+  }
+
+  if (pushHandoffSocketInfo(bestWorkerContext, &handoffSocketInfo))
+  {
+    return;
+  }
+
+  for (i = 0; i < proxyContext->numWorkerContexts; ++i)
+  {
+    if ((proxyContext->workerContextArray[i] != bestWorkerContext) &&
+        pushHandoffSocketInfo(proxyContext->workerContextArray[i],
+                              &handoffSocketInfo))
+    {
+      return;
+    }
+  }
+
+  proxyLog("all handoff queues full, closing fd %d", clientSocket);
+  signalSafeClose(clientSocket);
+}
+
+static void handleHandoffQueueReady(
+  struct AbstractReadyEventHandler* abstractReadyEventHandler,
+  const struct ReadyEventInfo* readyEventInfo,
+  struct ProxyContext* proxyContext)
+{
+  struct HandoffQueueInfo* handoffQueueInfo =
+    (struct HandoffQueueInfo*) abstractReadyEventHandler;
+  struct HandoffSocketInfo handoffSocketInfo;
+  char wakeupBuffer[64];
+  ssize_t retVal;
+  int i;
+
+  do
+  {
+    retVal = read(handoffQueueInfo->wakeupReadFD,
+                  wakeupBuffer, sizeof(wakeupBuffer));
+  } while ((retVal > 0) || ((retVal == -1) && (errno == EINTR)));
+
+  /* cleared before draining so a concurrent push always wakes us again */
+  atomic_store(&(handoffQueueInfo->wakeupPending), false);
+
+  for (i = 0;
+       (i < MAX_OPERATIONS_FOR_ONE_FD) &&
+       popSPSCRing(handoffQueueInfo->spscRing, &handoffSocketInfo);
+       ++i)
+  {
+    handleNewClientSocket(
+      handoffSocketInfo.socket,
+      &(handoffSocketInfo.clientSockAddrInfo),
+      handoffSocketInfo.listenAddrInfo,
+      proxyContext);
+  }
+
+  if (getSPSCRingSize(handoffQueueInfo->spscRing) > 0)
+  {
+    wakeupHandoffQueue(handoffQueueInfo);
+  }
+}
+
+static void addHealthCheckResult(
+  struct ProxyContext* proxyContext,
+  struct HealthCheckInfo* healthCheckInfo,
+  bool good)
+{
+  const struct ProxySettings* proxySettings = proxyContext->proxySettings;
+  const struct RemoteAddrInfo* remoteAddrInfo =
+    proxySettings->remoteAddrInfoArray + healthCheckInfo->remoteIndex;
+  const bool healthy =
+    isRemoteHealthy(proxyContext->remoteSelector,
+                    healthCheckInfo->remoteIndex);
+
+  if (good)
+  {
+    ++(healthCheckInfo->numGoodProbes);
+    healthCheckInfo->numFailedProbes = 0;
+    if ((!healthy) &&
+        (healthCheckInfo->numGoodProbes >= proxySettings->healthCheckRise))
+    {
+      proxyLog("remote %s:%s up after %u good health checks (thread=%u)",
+               remoteAddrInfo->addrPortStrings.addrString,
+               remoteAddrInfo->addrPortStrings.portString,
+               healthCheckInfo->numGoodProbes,
+               proxyContext->threadIndex);
+      setRemoteHealthy(proxyContext->remoteSelector,
+                       healthCheckInfo->remoteIndex, true);
+    }
+  }
+  else
+  {
+    ++(healthCheckInfo->numFailedProbes);
+    healthCheckInfo->numGoodProbes = 0;
+    if (healthy &&
+        (healthCheckInfo->numFailedProbes >= proxySettings->healthCheckFall))
+    {
+      proxyLog("remote %s:%s down after %u failed health checks (thread=%u)",
+               remoteAddrInfo->addrPortStrings.addrString,
+               remoteAddrInfo->addrPortStrings.portString,
+               healthCheckInfo->numFailedProbes,
+               proxyContext->threadIndex);
+      setRemoteHealthy(proxyContext->remoteSelector,
+                       healthCheckInfo->remoteIndex, false);
+    }
+  }
+}
+
+static void startHealthCheckProbe(
+  struct ProxyContext* proxyContext,
+  struct HealthCheckInfo* healthCheckInfo)
+{
+  const struct RemoteAddrInfo* remoteAddrInfo =
+    proxyContext->proxySettings->remoteAddrInfoArray +
+    healthCheckInfo->remoteIndex;
+  enum ConnectSocketResult connectSocketResult;
+  int probeSocket;
+
+  if (!createNonBlockingSocket(remoteAddrInfo->addrinfo, &probeSocket))
+  {
+    proxyLog("error creating health check socket errno = %d", errno);
+    addHealthCheckResult(proxyContext, healthCheckInfo, false);
+    return;
+  }
+
+  connectSocketResult = connectSocket(probeSocket, remoteAddrInfo->addrinfo);
+  if (connectSocketResult == CONNECT_SOCKET_RESULT_IN_PROGRESS)
+  {
+    healthCheckInfo->socket = probeSocket;
+    addPollFDForWrite(proxyContext->pollState, probeSocket, healthCheckInfo);
+    return;
+  }
+
+  signalSafeClose(probeSocket);
+  addHealthCheckResult(
+    proxyContext, healthCheckInfo,
+    (connectSocketResult == CONNECT_SOCKET_RESULT_CONNECTED));
+}
+
+static void stopHealthCheckProbe(
+  struct ProxyContext* proxyContext,
+  struct HealthCheckInfo* healthCheckInfo)
+{
+  removePollFDForWrite(proxyContext->pollState, healthCheckInfo->socket);
+  flushPollState(proxyContext->pollState);
+  signalSafeClose(healthCheckInfo->socket);
+  healthCheckInfo->socket = -1;
+}
+
+static void handleHealthCheckReady(
+  struct AbstractReadyEventHandler* abstractReadyEventHandler,
+  const struct ReadyEventInfo* readyEventInfo,
+  struct ProxyContext* proxyContext)
+{
+  struct HealthCheckInfo* healthCheckInfo =
+    (struct HealthCheckInfo*) abstractReadyEventHandler;
+
+  /* a write event queued behind a probe that already finished is ignored */
+  if (isReadyEventForWrite(readyEventInfo) &&
+      (healthCheckInfo->socket != -1))
+  {
+    const int socketError = getSocketError(healthCheckInfo->socket);
+    if (socketError != EINPROGRESS)
+    {
+      stopHealthCheckProbe(proxyContext, healthCheckInfo);
+      addHealthCheckResult(proxyContext, healthCheckInfo, (socketError == 0));
+    }
+  }
+
+  if (isReadyEventForTimeout(readyEventInfo))
+  {
+    if (healthCheckInfo->socket != -1)
+    {
+      stopHealthCheckProbe(proxyContext, healthCheckInfo);
+      addHealthCheckResult(proxyContext, healthCheckInfo, false);
+    }
+    startHealthCheckProbe(proxyContext, healthCheckInfo);
+  }
+}
+
+static void handleRemoteEjectionReady(
+  struct AbstractReadyEventHandler* abstractReadyEventHandler,
+  const struct ReadyEventInfo* readyEventInfo,
+  struct ProxyContext* proxyContext)
+{
+  struct RemoteEjectionInfo* remoteEjectionInfo =
+    (struct RemoteEjectionInfo*) abstractReadyEventHandler;
+  const struct RemoteAddrInfo* remoteAddrInfo =
+    proxyContext->proxySettings->remoteAddrInfoArray +
+    remoteEjectionInfo->remoteIndex;
+
+  proxyLog("remote %s:%s ejection ended (thread=%u)",
+           remoteAddrInfo->addrPortStrings.addrString,
+           remoteAddrInfo->addrPortStrings.portString,
+           proxyContext->threadIndex);
+
+  endRemoteEjection(proxyContext->remoteSelector,
+                    remoteEjectionInfo->remoteIndex);
+}
+
+static void handleRateLimitReady(
+  struct AbstractReadyEventHandler* abstractReadyEventHandler,
+  const struct ReadyEventInfo* readyEventInfo,
+  struct ProxyContext* proxyContext)
+{
+  struct RateLimitInfo* rateLimitInfo =
+    (struct RateLimitInfo*) abstractReadyEventHandler;
+  struct ConnectionSocketInfo* connectionSocketInfo;
+  uint32_t i;
+
+  /* what splices moved in the period that just ended is taken from its
+     tokens, before the refill */
+  TAILQ_FOREACH(connectionSocketInfo, proxyContext->activeList, entry)
+  {
+    if (connectionSocketInfo->spliceActive)
+    {
+      chargeActiveSplice(proxyContext, connectionSocketInfo);
+    }
+  }
+
+  for (i = 0; i < proxyContext->proxySettings->numListenAddrs; ++i)
+  {
+    struct ListenRateLimit* listenRateLimit =
+      rateLimitInfo->listenRateLimitArray + i;
+    refillTokenBucket(&(listenRateLimit->clientTokenBucket));
+    refillTokenBucket(&(listenRateLimit->remoteTokenBucket));
+  }
+
+  TAILQ_FOREACH(connectionSocketInfo, proxyContext->activeList, entry)
+  {
+    refillTokenBucket(&(connectionSocketInfo->tokenBucket));
+    if (connectionSocketInfo->rateLimited)
+    {
+      connectionSocketInfo->rateLimited = false;
+      setWaitingForRead(proxyContext, connectionSocketInfo, true);
+    }
+  }
+}
+
+static const char* loopPhaseNameArray[NUM_LOOP_PHASES] =
+{
+  "wait",
+  "handlers",
+  "destroy"
+};
+
+static const char* readyEventHandlerNameArray[NUM_READY_EVENT_HANDLER_TYPES] =
+{
+  "server socket",
+  "connection socket",
+  "handoff queue",
+  "periodic timer",
+  "health check",
+  "remote ejection",
+  "race connect",
+  "warm connection",
+  "pending client",
+  "rate limit"
+};
+
+static void logLog2Histogram(
+  const char* name,
+  const char* unit,
+  const struct Log2Histogram* log2Histogram)
+{
+  if (log2Histogram->count == 0)
+  {
+    return;
+  }
+
+  proxyLogNoTime("  %s count=%ju avg=%ju%s p50<=%ju%s p99<=%ju%s max=%ju%s",
+                 name,
+                 (uintmax_t)log2Histogram->count,
+                 (uintmax_t)(log2Histogram->sum / log2Histogram->count), unit,
+                 (uintmax_t)getLog2HistogramPercentile(log2Histogram, 50), unit,
+                 (uintmax_t)getLog2HistogramPercentile(log2Histogram, 99), unit,
+                 (uintmax_t)log2Histogram->max, unit);
+}
+
+static void logAndResetLoopStats(
+  struct ProxyContext* proxyContext)
+{
+  struct LoopStats* loopStats = proxyContext->loopStats;
+  int i;
+
+  proxyLog("Loop stats (thread=%u): [",
+           proxyContext->threadIndex);
+
+  for (i = 0; i < NUM_LOOP_PHASES; ++i)
+  {
+    logLog2Histogram(loopPhaseNameArray[i], "us",
+                     &(loopStats->phaseHistogramArray[i]));
+    resetLog2Histogram(&(loopStats->phaseHistogramArray[i]));
+  }
+
+  for (i = 0; i < NUM_READY_EVENT_HANDLER_TYPES; ++i)
+  {
+    logLog2Histogram(readyEventHandlerNameArray[i], "us",
+                     &(loopStats->handlerHistogramArray[i]));
+    resetLog2Histogram(&(loopStats->handlerHistogramArray[i]));
+  }
+
+  logLog2Histogram("events per wait", "",
+                   &(loopStats->eventsPerWaitHistogram));
+  resetLog2Histogram(&(loopStats->eventsPerWaitHistogram));
+
+  proxyLogNoTime("]");
+}
+
+static void logRelayPipePoolStats(
+  const struct ProxyContext* proxyContext)
+{
+  const struct PipePoolStats* pipePoolStats =
+    getPipePoolStats(proxyContext->relayPipePool);
+
+  proxyLog("Relay pipe pool (thread=%u): in use=%zu free=%zu max in use=%zu",
+           proxyContext->threadIndex,
+           pipePoolStats->numInUse,
+           pipePoolStats->numFree,
+           pipePoolStats->maxInUse);
+}
+
+static void logObjectPoolStats(
+  const char* name,
+  const struct ProxyContext* proxyContext,
+  const struct ObjectPool* objectPool)
+{
+  const struct ObjectPoolStats* objectPoolStats =
+    getObjectPoolStats(objectPool);
+
+  proxyLog("%s pool (thread=%u): in use=%zu free=%zu max in use=%zu "
+           "slabs=%zu",
+           name,
+           proxyContext->threadIndex,
+           objectPoolStats->numInUse,
+           objectPoolStats->numFree,
+           objectPoolStats->maxInUse,
+           objectPoolStats->numSlabs);
+}
+
+static const char* getRemoteStateString(
+  const struct RemoteSelector* remoteSelector,
+  size_t remoteIndex)
+{
+  if (isRemoteEjected(remoteSelector, remoteIndex))
   {
-    int acceptedFD;
-    struct SockAddrInfo clientSockAddrInfo;
+    return "ejected";
+  }
+  else if (!isRemoteHealthy(remoteSelector, remoteIndex))
+  {
+    return "down";
+  }
+  return "up";
+}
 
-    acceptSocketResult = acceptSocket(
-      serverSocketInfo->socket,
-      &acceptedFD,
-      &clientSockAddrInfo);
+static void logRemoteSessions(
+  const struct ProxyContext* proxyContext)
+{
+  const struct ProxySettings* proxySettings = proxyContext->proxySettings;
+  size_t i;
 
-    if (acceptSocketResult == ACCEPT_SOCKET_RESULT_ERROR)
-    {
-      proxyLog("accept error errno %d: %s", errno, errnoToString(errno));
-    }
-    else if (acceptSocketResult == ACCEPT_SOCKET_RESULT_SUCCESS)
-    {
-      proxyLog("accept fd %d", acceptedFD);
-      handleNewClientSocket(
-        acceptedFD,
-        &clientSockAddrInfo,
-        proxyContext);
-    }
+  proxyLog("Remote sessions (thread=%u): [",
+           proxyContext->threadIndex);
+
+  for (i = 0; i < proxySettings->remoteAddrInfoArrayLength; ++i)
+  {
+    proxyLogNoTime("  [%zu] %s:%s %s sessions=%zu warm=%zu connect ewma=%juus",
+                   i,
+                   proxySettings->remoteAddrInfoArray[i].addrPortStrings.addrString,
+                   proxySettings->remoteAddrInfoArray[i].addrPortStrings.portString,
+                   getRemoteStateString(proxyContext->remoteSelector, i),
+                   getRemoteNumSessions(proxyContext->remoteSelector, i),
+                   getNumIdleWarmConnections(proxyContext, i),
+                   (uintmax_t)getRemoteConnectTimeEWMA(
+                                proxyContext->remoteSelector, i));
   }
+
+  proxyLogNoTime("]");
 }
 
 static void handlePeriodicTimerReady(
@@ -722,83 +3327,426 @@ static void handlePeriodicTimerReady(
 
   TAILQ_FOREACH(connectionSocketInfo, proxyContext->activeList, entry)
   {
+    struct AddrPortStrings clientAddrPortStrings;
+    struct AddrPortStrings serverAddrPortStrings;
+
     if (!foundConnection)
     {
-      proxyLog("Active connections: [");
+      proxyLog("Active connections (thread=%u): [",
+               proxyContext->threadIndex);
       foundConnection = true;
     }
 
-    proxyLogNoTime("  fd=%d rfd=%d cw=%d rw=%d %s:%s -> %s:%s bytes=%jd",
+    getConnectionAddrPortStrings(connectionSocketInfo,
+                                 &clientAddrPortStrings,
+                                 &serverAddrPortStrings);
+
+    proxyLogNoTime("  fd=%d rfd=%d cw=%d rw=%d rf=%d rl=%d %s:%s -> %s:%s "
+                   "bytes in=%jd out=%jd",
                    connectionSocketInfo->socket,
                    connectionSocketInfo->relatedConnectionSocketInfo->socket,
                    connectionSocketInfo->waitingForConnect,
                    connectionSocketInfo->waitingForRead,
-                   connectionSocketInfo->clientAddrPortStrings.addrString,
-                   connectionSocketInfo->clientAddrPortStrings.portString,
-                   connectionSocketInfo->serverAddrPortStrings.addrString,
-                   connectionSocketInfo->serverAddrPortStrings.portString,
-                   (intmax_t)getSpliceBytesTransferred(
-                               connectionSocketInfo->socket));
+                   connectionSocketInfo->readFinished,
+                   connectionSocketInfo->rateLimited,
+                   clientAddrPortStrings.addrString,
+                   clientAddrPortStrings.portString,
+                   serverAddrPortStrings.addrString,
+                   serverAddrPortStrings.portString,
+                   (intmax_t)getBytesTransferred(
+                     proxyContext, connectionSocketInfo),
+                   (intmax_t)getBytesTransferred(
+                     proxyContext,
+                     connectionSocketInfo->relatedConnectionSocketInfo));
   }
 
   if (foundConnection)
   {
     proxyLogNoTime("]");
   }
+
+  if (proxyContext->connectionPairPool != NULL)
+  {
+    logObjectPoolStats("Session", proxyContext,
+                       proxyContext->connectionPairPool);
+  }
+
+  if (proxyContext->relayBufferPool != NULL)
+  {
+    logObjectPoolStats("Relay buffer", proxyContext,
+                       proxyContext->relayBufferPool);
+  }
+
+  if (proxyContext->relayPipePool != NULL)
+  {
+    logRelayPipePoolStats(proxyContext);
+  }
+
+  if (proxyContext->pendingClientQueueInfo != NULL)
+  {
+    proxyLog("Pending clients (thread=%u): %zu",
+             proxyContext->threadIndex,
+             proxyContext->pendingClientQueueInfo->numPendingClients);
+  }
+
+  if (proxyContext->remoteSelector != NULL)
+  {
+    logRemoteSessions(proxyContext);
+  }
+
+  if (proxyContext->loopStats != NULL)
+  {
+    logAndResetLoopStats(proxyContext);
+  }
 }
 
+static const char* balanceModeNameArray[] =
+{
+  "random",
+  "leastconn",
+  "p2c",
+  "maglev",
+  "wrr"
+};
+
+static const char* relayModeNameArray[] =
+{
+  "sosplice",
+  "copy",
+  "pipe"
+};
+
 static void logSettings(
   const struct ProxySettings* proxySettings)
 {
+  const struct ListenAddrInfo* listenAddrInfo;
   size_t i;
 
   proxyLog("log flush stdout = %s",
            (proxySettings->flushAfterLog ? "true" : "false"));
 
+  proxyLog("num listen addresses = %u",
+           proxySettings->numListenAddrs);
+  SIMPLEQ_FOREACH(listenAddrInfo, proxySettings->listenAddrInfoList, entry)
+  {
+    struct AddrPortStrings addrPortStrings;
+    if (!addrInfoToNameAndPort(listenAddrInfo->addrinfo, &addrPortStrings))
+    {
+      setUnknownAddrPortStrings(&addrPortStrings);
+    }
+    proxyLog("listen address [%u] = %s:%s bytes per second %ju",
+             listenAddrInfo->index,
+             addrPortStrings.addrString,
+             addrPortStrings.portString,
+             (uintmax_t)listenAddrInfo->bytesPerSecond);
+  }
+
   proxyLog("num remote addresses = %zu",
            proxySettings->remoteAddrInfoArrayLength);
   for (i = 0; i < proxySettings->remoteAddrInfoArrayLength; ++i)
   {
-    proxyLog("remote address [%zu] = %s:%s", i,
+    proxyLog("remote address [%zu] = %s:%s weight %u max sessions %u", i,
              proxySettings->remoteAddrInfoArray[i].addrPortStrings.addrString,
-             proxySettings->remoteAddrInfoArray[i].addrPortStrings.portString);
+             proxySettings->remoteAddrInfoArray[i].addrPortStrings.portString,
+             proxySettings->remoteAddrInfoArray[i].weight,
+             proxySettings->remoteAddrInfoArray[i].maxSessions);
   }
   proxyLog("connect timeout milliseconds = %d",
            proxySettings->connectTimeoutMS);
+  proxyLog("connect retries = %u",
+           proxySettings->connectRetries);
+  proxyLog("race connect milliseconds = %u",
+           proxySettings->raceConnectDelayMS);
+  proxyLog("warm connections per remote = %u idle milliseconds = %u",
+           proxySettings->warmConnections,
+           proxySettings->warmIdleMS);
+  proxyLog("pending clients = %u milliseconds = %u",
+           proxySettings->pendingClients,
+           proxySettings->pendingClientMS);
   proxyLog("periodic log milliseconds = %d",
            proxySettings->periodicLogMS);
+  proxyLog("max events per wait = %u",
+           proxySettings->maxEventsPerWait);
+  proxyLog("preallocated sessions per thread = %u",
+           proxySettings->preallocatedSessions);
+  proxyLog("quiet = %s",
+           (proxySettings->quiet ? "true" : "false"));
+  proxyLog("balance mode = %s",
+           balanceModeNameArray[proxySettings->balanceMode]);
+  proxyLog("relay mode = %s",
+           relayModeNameArray[proxySettings->relayMode]);
+  proxyLog("session bytes per second = %ju",
+           (uintmax_t)proxySettings->sessionBytesPerSecond);
+  proxyLog("health check milliseconds = %u rise = %u fall = %u",
+           proxySettings->healthCheckIntervalMS,
+           proxySettings->healthCheckRise,
+           proxySettings->healthCheckFall);
+  proxyLog("outlier connect failures = %u ejection milliseconds = %u "
+           "max ejection percent = %u",
+           proxySettings->outlierConnectFailures,
+           proxySettings->outlierEjectionMS,
+           proxySettings->outlierMaxEjectionPercent);
+  proxyLog("threads = %u",
+           proxySettings->numThreads);
+  proxyLog("acceptor thread = %s",
+           (proxySettings->acceptorThread ? "true" : "false"));
 }
 
 static struct ProxyContext* createProxyContext(
-  const struct ProxySettings* proxySettings)
+  const struct ProxySettings* proxySettings,
+  uint32_t threadIndex)
 {
   struct ProxyContext* proxyContext = checkedCallocOne(sizeof(struct ProxyContext));
 
   proxyContext->proxySettings = proxySettings;
-  proxyContext->pollState = newPollState();
+  proxyContext->threadIndex = threadIndex;
+  proxyContext->pollState = newPollState(proxySettings->maxEventsPerWait);
   proxyContext->activeList = newTAILQ();
   proxyContext->destroyedList = newTAILQ();
+  atomic_init(&(proxyContext->numSessions), 0);
 
   return proxyContext;
 }
 
-static void runProxy(
-  const struct ProxySettings* proxySettings)
+static void setupHandoffQueue(
+  struct ProxyContext* proxyContext)
 {
-  struct ProxyContext* proxyContext;
+  struct HandoffQueueInfo* handoffQueueInfo =
+    checkedCallocOne(sizeof(struct HandoffQueueInfo));
+  int pipeFDArray[2];
 
-  proxyLogSetFlush(proxySettings->flushAfterLog);
+  handoffQueueInfo->handleReadyEventFunction = handleHandoffQueueReady;
 
-  logSettings(proxySettings);
+  if (!createNonBlockingPipe(pipeFDArray))
+  {
+    proxyLog("handoff pipe error errno %d: %s",
+             errno, errnoToString(errno));
+    abort();
+  }
+  handoffQueueInfo->wakeupReadFD = pipeFDArray[0];
+  handoffQueueInfo->wakeupWriteFD = pipeFDArray[1];
+  atomic_init(&(handoffQueueInfo->wakeupPending), false);
+  handoffQueueInfo->spscRing =
+    newSPSCRing(HANDOFF_QUEUE_CAPACITY, sizeof(struct HandoffSocketInfo));
+
+  proxyContext->handoffQueueInfo = handoffQueueInfo;
+
+  addPollFDForRead(
+    proxyContext->pollState,
+    handoffQueueInfo->wakeupReadFD,
+    handoffQueueInfo);
+}
+
+static void setupConnectionPairPool(
+  struct ProxyContext* proxyContext)
+{
+  proxyContext->connectionPairPool =
+    newObjectPool(sizeof(struct ConnectionPair),
+                  proxyContext->proxySettings->preallocatedSessions);
+}
+
+/* Buffers and pipes are only held while data is in flight.  Creating a
+   pipe takes system calls, so one per preallocated session is made up
+   front. */
+static void setupRelayPool(
+  struct ProxyContext* proxyContext)
+{
+  if (proxyContext->proxySettings->relayMode == RELAY_COPY)
+  {
+    proxyContext->relayBufferPool =
+      newObjectPool(sizeof(struct RelayBuffer), 0);
+  }
+  else if (proxyContext->proxySettings->relayMode == RELAY_PIPE)
+  {
+    proxyContext->relayPipePool =
+      newPipePool(RELAY_PIPE_SIZE,
+                  proxyContext->proxySettings->preallocatedSessions);
+  }
+}
+
+static void setupPendingClientQueue(
+  struct ProxyContext* proxyContext)
+{
+  const struct ProxySettings* proxySettings = proxyContext->proxySettings;
+  struct PendingClientQueueInfo* pendingClientQueueInfo;
+
+  if (proxySettings->pendingClients == 0)
+  {
+    return;
+  }
+
+  pendingClientQueueInfo =
+    checkedCallocOne(sizeof(struct PendingClientQueueInfo));
+  pendingClientQueueInfo->handleReadyEventFunction =
+    handlePendingClientQueueReady;
+  pendingClientQueueInfo->pendingClientArray =
+    checkedReallocarray(NULL,
+                        proxySettings->pendingClients,
+                        sizeof(struct PendingClientInfo));
+  pendingClientQueueInfo->capacity = proxySettings->pendingClients;
+
+  proxyContext->pendingClientQueueInfo = pendingClientQueueInfo;
+}
+
+static void setupRemoteSelector(
+  struct ProxyContext* proxyContext)
+{
+  const struct ProxySettings* proxySettings = proxyContext->proxySettings;
+  size_t i;
+
+  proxyContext->remoteSelector = newRemoteSelector(proxySettings);
+
+  if (proxySettings->outlierConnectFailures > 0)
+  {
+    proxyContext->remoteEjectionInfoArray =
+      checkedReallocarray(NULL,
+                          proxySettings->remoteAddrInfoArrayLength,
+                          sizeof(struct RemoteEjectionInfo));
+    for (i = 0; i < proxySettings->remoteAddrInfoArrayLength; ++i)
+    {
+      struct RemoteEjectionInfo* remoteEjectionInfo =
+        proxyContext->remoteEjectionInfoArray + i;
+      memset(remoteEjectionInfo, 0, sizeof(struct RemoteEjectionInfo));
+      remoteEjectionInfo->handleReadyEventFunction =
+        handleRemoteEjectionReady;
+      remoteEjectionInfo->remoteIndex = i;
+    }
+  }
+}
+
+/* The first probe of every remote starts right away. */
+static void setupHealthChecks(
+  struct ProxyContext* proxyContext)
+{
+  const struct ProxySettings* proxySettings = proxyContext->proxySettings;
+  size_t i;
+
+  if (proxySettings->healthCheckIntervalMS == 0)
+  {
+    return;
+  }
+
+  for (i = 0; i < proxySettings->remoteAddrInfoArrayLength; ++i)
+  {
+    struct HealthCheckInfo* healthCheckInfo =
+      checkedCallocOne(sizeof(struct HealthCheckInfo));
+    healthCheckInfo->handleReadyEventFunction = handleHealthCheckReady;
+    healthCheckInfo->remoteIndex = i;
+    healthCheckInfo->socket = -1;
+
+    addPollIDForPeriodicTimer(
+      proxyContext->pollState,
+      HEALTH_CHECK_TIMER_ID,
+      healthCheckInfo,
+      proxySettings->healthCheckIntervalMS);
+
+    startHealthCheckProbe(proxyContext, healthCheckInfo);
+  }
+
+  flushPollState(proxyContext->pollState);
+}
+
+/* Every warm connection slot starts connecting right away. */
+static void setupWarmConnections(
+  struct ProxyContext* proxyContext)
+{
+  const struct ProxySettings* proxySettings = proxyContext->proxySettings;
+  const size_t numWarmConnectionInfos =
+    proxySettings->remoteAddrInfoArrayLength * proxySettings->warmConnections;
+  size_t i;
+
+  if (numWarmConnectionInfos == 0)
+  {
+    return;
+  }
+
+  proxyContext->warmConnectionInfoArray =
+    checkedReallocarray(NULL,
+                        numWarmConnectionInfos,
+                        sizeof(struct WarmConnectionInfo));
+  for (i = 0; i < numWarmConnectionInfos; ++i)
+  {
+    struct WarmConnectionInfo* warmConnectionInfo =
+      proxyContext->warmConnectionInfoArray + i;
+    memset(warmConnectionInfo, 0, sizeof(struct WarmConnectionInfo));
+    warmConnectionInfo->handleReadyEventFunction = handleWarmConnectionReady;
+    warmConnectionInfo->remoteIndex = i / proxySettings->warmConnections;
+    warmConnectionInfo->socket = -1;
+    warmConnectionInfo->state = WARM_CONNECTION_EMPTY;
+
+    startWarmConnection(proxyContext, warmConnectionInfo);
+  }
+
+  flushPollState(proxyContext->pollState);
+}
+
+/* Listen address byte rates are split evenly between the event loop
+   threads, each refills its own buckets. */
+static void setupRateLimit(
+  struct ProxyContext* proxyContext)
+{
+  const struct ProxySettings* proxySettings = proxyContext->proxySettings;
+  const struct ListenAddrInfo* listenAddrInfo;
+  struct RateLimitInfo* rateLimitInfo;
+  bool listenRateLimited = false;
+
+  SIMPLEQ_FOREACH(listenAddrInfo, proxySettings->listenAddrInfoList, entry)
+  {
+    if (listenAddrInfo->bytesPerSecond > 0)
+    {
+      listenRateLimited = true;
+    }
+  }
 
-  proxyContext = createProxyContext(proxySettings);
+  if ((!listenRateLimited) &&
+      (proxySettings->sessionBytesPerSecond == 0))
+  {
+    return;
+  }
+
+  rateLimitInfo = checkedCallocOne(sizeof(struct RateLimitInfo));
+  rateLimitInfo->handleReadyEventFunction = handleRateLimitReady;
+  rateLimitInfo->listenRateLimitArray =
+    checkedReallocarray(NULL,
+                        proxySettings->numListenAddrs,
+                        sizeof(struct ListenRateLimit));
+
+  SIMPLEQ_FOREACH(listenAddrInfo, proxySettings->listenAddrInfoList, entry)
+  {
+    struct ListenRateLimit* listenRateLimit =
+      rateLimitInfo->listenRateLimitArray + listenAddrInfo->index;
+    /* the first threads take the remainder so the threads add up to it */
+    const uint64_t threadBytesPerSecond =
+      (listenAddrInfo->bytesPerSecond / proxySettings->numThreads) +
+      ((proxyContext->threadIndex <
+        (listenAddrInfo->bytesPerSecond % proxySettings->numThreads)) ?
+       1 : 0);
+    initTokenBucket(&(listenRateLimit->clientTokenBucket),
+                    threadBytesPerSecond, RATE_LIMIT_REFILL_MS);
+    initTokenBucket(&(listenRateLimit->remoteTokenBucket),
+                    threadBytesPerSecond, RATE_LIMIT_REFILL_MS);
+    listenRateLimit->numSessions = 0;
+  }
+
+  proxyContext->rateLimitInfo = rateLimitInfo;
+
+  addPollIDForPeriodicTimer(
+    proxyContext->pollState,
+    RATE_LIMIT_TIMER_ID,
+    rateLimitInfo,
+    RATE_LIMIT_REFILL_MS);
+}
 
-  setupServerSockets(proxyContext);
+static void setupPeriodicTimer(
+  struct ProxyContext* proxyContext)
+{
+  const struct ProxySettings* proxySettings = proxyContext->proxySettings;
 
   if (proxySettings->periodicLogMS > 0)
   {
     struct PeriodicTimerInfo* periodicTimerInfo =
       checkedCallocOne(sizeof(struct PeriodicTimerInfo));
+    proxyContext->loopStats = checkedCallocOne(sizeof(struct LoopStats));
     periodicTimerInfo->handleReadyEventFunction = handlePeriodicTimerReady;
 
     addPollIDForPeriodicTimer(
@@ -807,6 +3755,64 @@ static void runProxy(
       periodicTimerInfo,
       proxySettings->periodicLogMS);
   }
+}
+
+static enum ReadyEventHandlerType getReadyEventHandlerType(
+  HandleReadyEventFunction handleReadyEventFunction)
+{
+  if (handleReadyEventFunction == handleConnectionSocketReady)
+  {
+    return CONNECTION_SOCKET_HANDLER;
+  }
+  else if (handleReadyEventFunction == handleServerSocketReady)
+  {
+    return SERVER_SOCKET_HANDLER;
+  }
+  else if (handleReadyEventFunction == handleHandoffQueueReady)
+  {
+    return HANDOFF_QUEUE_HANDLER;
+  }
+  else if (handleReadyEventFunction == handleHealthCheckReady)
+  {
+    return HEALTH_CHECK_HANDLER;
+  }
+  else if (handleReadyEventFunction == handleRemoteEjectionReady)
+  {
+    return REMOTE_EJECTION_HANDLER;
+  }
+  else if (handleReadyEventFunction == handleRaceConnectReady)
+  {
+    return RACE_CONNECT_HANDLER;
+  }
+  else if (handleReadyEventFunction == handleWarmConnectionReady)
+  {
+    return WARM_CONNECTION_HANDLER;
+  }
+  else if (handleReadyEventFunction == handlePendingClientQueueReady)
+  {
+    return PENDING_CLIENT_HANDLER;
+  }
+  else if (handleReadyEventFunction == handleRateLimitReady)
+  {
+    return RATE_LIMIT_HANDLER;
+  }
+  return PERIODIC_TIMER_HANDLER;
+}
+
+/* Adds the time since *lastTimeUS to the histogram and advances it. */
+static void addLoopStatsInterval(
+  struct Log2Histogram* log2Histogram,
+  uint64_t* lastTimeUS)
+{
+  const uint64_t nowUS = getMonotonicTimeUS();
+  addLog2HistogramValue(log2Histogram, nowUS - (*lastTimeUS));
+  *lastTimeUS = nowUS;
+}
+
+static void runProxyLoop(
+  struct ProxyContext* proxyContext)
+{
+  uint64_t lastTimeUS = getMonotonicTimeUS();
 
   while (true)
   {
@@ -815,29 +3821,183 @@ static void runProxy(
       pollResult->readyEventInfoArray;
     const struct ReadyEventInfo* endReadyEventInfo =
       readyEventInfo + pollResult->numReadyEvents;
+    struct LoopStats* loopStats = proxyContext->loopStats;
+    uint64_t handlersStartTimeUS = 0;
+
+    if (loopStats != NULL)
+    {
+      addLoopStatsInterval(
+        &(loopStats->phaseHistogramArray[LOOP_PHASE_WAIT]), &lastTimeUS);
+      addLog2HistogramValue(
+        &(loopStats->eventsPerWaitHistogram), pollResult->numReadyEvents);
+      handlersStartTimeUS = lastTimeUS;
+    }
 
     for (; readyEventInfo != endReadyEventInfo;
          ++readyEventInfo)
     {
       struct AbstractReadyEventHandler* abstractReadyEventHandler =
-        readyEventInfo->data;
+        getReadyEventData(readyEventInfo);
       (*(abstractReadyEventHandler->handleReadyEventFunction))(
         abstractReadyEventHandler, 
         readyEventInfo,
         proxyContext);
+
+      /* one clock read per event, each handler starts when the last ended */
+      if (loopStats != NULL)
+      {
+        addLoopStatsInterval(
+          &(loopStats->handlerHistogramArray[
+              getReadyEventHandlerType(
+                abstractReadyEventHandler->handleReadyEventFunction)]),
+          &lastTimeUS);
+      }
+    }
+
+    if (loopStats != NULL)
+    {
+      addLog2HistogramValue(
+        &(loopStats->phaseHistogramArray[LOOP_PHASE_HANDLERS]),
+        lastTimeUS - handlersStartTimeUS);
     }
 
     destroyMarkedConnections(proxyContext);
+
+    if (loopStats != NULL)
+    {
+      addLoopStatsInterval(
+        &(loopStats->phaseHistogramArray[LOOP_PHASE_DESTROY]), &lastTimeUS);
+    }
+  }
+}
+
+static void* runProxyThread(
+  void* arg)
+{
+  runProxyLoop((struct ProxyContext*) arg);
+  return NULL;
+}
+
+static void startProxyThread(
+  struct ProxyContext* proxyContext)
+{
+  pthread_t thread;
+  const int retVal = pthread_create(
+    &thread, NULL, runProxyThread, proxyContext);
+  if (retVal != 0)
+  {
+    proxyLog("pthread_create error %d: %s",
+             retVal, errnoToString(retVal));
+    abort();
+  }
+}
+
+static void runProxy(
+  const struct ProxySettings* proxySettings)
+{
+  struct ProxyContext** proxyContextArray;
+  uint32_t i;
+
+  proxyLogSetFlush(proxySettings->flushAfterLog);
+
+  logSettings(proxySettings);
+
+  proxyContextArray =
+    checkedReallocarray(NULL,
+                        proxySettings->numThreads,
+                        sizeof(struct ProxyContext*));
+
+  if (proxySettings->acceptorThread)
+  {
+    /*
+     * One thread accepts on every listener and hands clients to the
+     * least loaded worker through a ring buffer and a wakeup pipe.
+     */
+    struct ProxyContext* acceptorContext =
+      createProxyContext(proxySettings, proxySettings->numThreads);
+
+    for (i = 0; i < proxySettings->numThreads; ++i)
+    {
+      proxyContextArray[i] = createProxyContext(proxySettings, i);
+
+      setupHandoffQueue(proxyContextArray[i]);
+
+      setupConnectionPairPool(proxyContextArray[i]);
+
+      setupRelayPool(proxyContextArray[i]);
+
+      setupPendingClientQueue(proxyContextArray[i]);
+
+      setupRemoteSelector(proxyContextArray[i]);
+
+      setupHealthChecks(proxyContextArray[i]);
+
+      setupWarmConnections(proxyContextArray[i]);
+
+      setupRateLimit(proxyContextArray[i]);
+
+      setupPeriodicTimer(proxyContextArray[i]);
+    }
+
+    acceptorContext->workerContextArray = proxyContextArray;
+    acceptorContext->numWorkerContexts = proxySettings->numThreads;
+
+    setupServerSockets(acceptorContext, handoffClientSocket);
+
+    for (i = 0; i < proxySettings->numThreads; ++i)
+    {
+      startProxyThread(proxyContextArray[i]);
+    }
+
+    runProxyLoop(acceptorContext);
+  }
+  else
+  {
+    /*
+     * Each thread owns a PollState, connection lists and a SO_REUSEPORT
+     * copy of every listener, so nothing is shared on the hot path.
+     */
+    for (i = 0; i < proxySettings->numThreads; ++i)
+    {
+      proxyContextArray[i] = createProxyContext(proxySettings, i);
+
+      setupServerSockets(proxyContextArray[i], handleNewClientSocket);
+
+      setupConnectionPairPool(proxyContextArray[i]);
+
+      setupRelayPool(proxyContextArray[i]);
+
+      setupPendingClientQueue(proxyContextArray[i]);
+
+      setupRemoteSelector(proxyContextArray[i]);
+
+      setupHealthChecks(proxyContextArray[i]);
+
+      setupWarmConnections(proxyContextArray[i]);
+
+      setupRateLimit(proxyContextArray[i]);
+
+      setupPeriodicTimer(proxyContextArray[i]);
+    }
+
+    for (i = 1; i < proxySettings->numThreads; ++i)
+    {
+      startProxyThread(proxyContextArray[i]);
+    }
+
+    runProxyLoop(proxyContextArray[0]);
   }
 }
 
 static void setupInitialPledge()
 {
+#ifdef __OpenBSD__
   if (pledge("stdio inet dns", NULL) == -1)
   {
     proxyLog("initial pledge failed");
     abort();
   }
+#endif
 }
 
 static void setupSignals()
@@ -847,11 +4007,13 @@ static void setupSignals()
 
 static void setupRunLoopPledge()
 {
+#ifdef __OpenBSD__
   if (pledge("stdio inet", NULL) == -1)
   {
     proxyLog("run loop pledge failed");
     abort();
   }
+#endif
 }
 
 int main(
@@ -1,13 +1,59 @@
 #include "log.h"
 #include "memutil.h"
 #include "proxysettings.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#define getprogname() (program_invocation_short_name)
+#endif
+
 #define DEFAULT_CONNECT_TIMEOUT_MS (5000)
+#define DEFAULT_CONNECT_RETRIES (0)
+#define MAX_CONNECT_RETRIES (16)
+#define DEFAULT_RACE_CONNECT_DELAY_MS (0)
 #define DEFAULT_PERIODIC_LOG_MS (0)
+#define DEFAULT_NUM_THREADS (1)
+#define MAX_NUM_THREADS (256)
+#define DEFAULT_MAX_EVENTS_PER_WAIT (1024)
+#define MAX_MAX_EVENTS_PER_WAIT (65536)
+#define DEFAULT_PREALLOCATED_SESSIONS (0)
+#define MAX_PREALLOCATED_SESSIONS (1000000)
+#define DEFAULT_REMOTE_WEIGHT (1)
+#define MAX_REMOTE_WEIGHT (1000)
+#define DEFAULT_REMOTE_MAX_SESSIONS (0)
+#define MAX_REMOTE_MAX_SESSIONS (1000000)
+#define DEFAULT_HEALTH_CHECK_INTERVAL_MS (0)
+#define DEFAULT_HEALTH_CHECK_RISE (2)
+#define DEFAULT_HEALTH_CHECK_FALL (3)
+#define MAX_HEALTH_CHECK_THRESHOLD (100)
+#define DEFAULT_OUTLIER_CONNECT_FAILURES (0)
+#define MAX_OUTLIER_CONNECT_FAILURES (1000)
+#define DEFAULT_OUTLIER_EJECTION_MS (30 * 1000)
+#define DEFAULT_OUTLIER_MAX_EJECTION_PERCENT (10)
+#define DEFAULT_WARM_CONNECTIONS (0)
+#define MAX_WARM_CONNECTIONS (1000)
+#define DEFAULT_WARM_IDLE_MS (30 * 1000)
+#define DEFAULT_PENDING_CLIENTS (0)
+#define MAX_PENDING_CLIENTS (100000)
+#define DEFAULT_PENDING_CLIENT_MS (5000)
+#define MAX_BYTES_PER_SECOND (100000000000LL)
+#if defined(SO_SPLICE)
+#define DEFAULT_RELAY_MODE (RELAY_SO_SPLICE)
+#define DEFAULT_RELAY_MODE_NAME "sosplice"
+#elif defined(SPLICE_F_MOVE)
+#define DEFAULT_RELAY_MODE (RELAY_PIPE)
+#define DEFAULT_RELAY_MODE_NAME "pipe"
+#else
+#define DEFAULT_RELAY_MODE (RELAY_COPY)
+#define DEFAULT_RELAY_MODE_NAME "copy"
+#endif
 
 static void printUsageAndExit()
 {
@@ -15,17 +61,100 @@ static void printUsageAndExit()
     "Usage:\n"
     "  %s [options]\n"
     "Options:\n"
-    "  -l <listen addr:listen port>\t\tlisten address and port, >= 1 required\n"
-    "  -r <remote addr:remote port>\t\tremote address and port, >= 1 required\n"
+    "  -a\t\t\t\t\tdedicated acceptor thread feeding the -t threads\n"
+    "  -b <random|leastconn|p2c|maglev|wrr>\tremote balancing, default = random\n"
+    "  -l <listen addr:listen port[,bytes per second]>\n"
+    "\t\t\t\t\tlisten address and port, >= 1 required,\n"
+    "\t\t\t\t\tbytes per second in each direction for all\n"
+    "\t\t\t\t\tits sessions, >= threads, 0 = no limit\n"
+    "  -r <remote addr:remote port[,weight[,max sessions]]>\n"
+    "\t\t\t\t\tremote address and port, >= 1 required,\n"
+    "\t\t\t\t\tmax sessions per thread, 0 = no limit\n"
     "  -c <connect timeout milliseconds>\tdefault = %d\n"
+    "  -d <health check fall>\t\tfailed probes to mark down, default = %d\n"
+    "  -e <max events per wait>\t\tdefault = %d\n"
     "  -f\t\t\t\t\tflush stdout on each log\n"
-    "  -p <periodic log milliseconds>\t0 = disable, default = %d\n",
+    "  -g <pending clients>\t\t\tper thread waiting while all remotes are at\n"
+    "\t\t\t\t\tmax sessions, default = %d\n"
+    "  -i <health check milliseconds>\tremote probe interval, 0 = disable, "
+    "default = %d\n"
+    "  -j <ejection milliseconds>\t\tfirst outlier ejection time, "
+    "default = %d\n"
+    "  -k <warm idle milliseconds>\t\tclose unused warm connections after, "
+    "default = %d\n"
+    "  -m <max ejection percent>\t\tof remotes, at least 1 remote, "
+    "default = %d\n"
+    "  -n <sessions>\t\t\t\tpreallocated sessions per thread, default = %d\n"
+    "  -o <connect failures>\t\t\tin a row to eject a remote, 0 = disable, "
+    "default = %d\n"
+    "  -p <periodic log milliseconds>\t0 = disable, default = %d\n"
+    "  -q\t\t\t\t\tno per connection logs\n"
+    "  -s <pending milliseconds>\t\tclose pending clients after, default = %d\n"
+    "  -t <threads>\t\t\t\tevent loop threads, default = %d\n"
+    "  -u <health check rise>\t\tgood probes to mark up, default = %d\n"
+    "  -v <bytes per second>\t\t\tper session in each direction, "
+    "0 = no limit\n"
+    "  -w <warm connections>\t\t\tper remote per thread, 0 = disable, "
+    "default = %d\n"
+    "  -x <connect retries>\t\t\tto other remotes per client, default = %d\n"
+    "  -y <race connect milliseconds>\tsecond connect to another remote after,\n"
+    "\t\t\t\t\t0 = disable, default = %d\n"
+    "  -z <sosplice|pipe|copy>\t\tdata relay, default = %s\n",
     getprogname(),
     DEFAULT_CONNECT_TIMEOUT_MS,
-    DEFAULT_PERIODIC_LOG_MS);
+    DEFAULT_HEALTH_CHECK_FALL,
+    DEFAULT_MAX_EVENTS_PER_WAIT,
+    DEFAULT_PENDING_CLIENTS,
+    DEFAULT_HEALTH_CHECK_INTERVAL_MS,
+    DEFAULT_OUTLIER_EJECTION_MS,
+    DEFAULT_WARM_IDLE_MS,
+    DEFAULT_OUTLIER_MAX_EJECTION_PERCENT,
+    DEFAULT_PREALLOCATED_SESSIONS,
+    DEFAULT_OUTLIER_CONNECT_FAILURES,
+    DEFAULT_PERIODIC_LOG_MS,
+    DEFAULT_PENDING_CLIENT_MS,
+    DEFAULT_NUM_THREADS,
+    DEFAULT_HEALTH_CHECK_RISE,
+    DEFAULT_WARM_CONNECTIONS,
+    DEFAULT_CONNECT_RETRIES,
+    DEFAULT_RACE_CONNECT_DELAY_MS,
+    DEFAULT_RELAY_MODE_NAME);
   exit(1);
 }
 
+/* strtonum(3), which not every libc has. */
+static long long parseNumber(
+  const char* string,
+  long long minValue,
+  long long maxValue,
+  const char** errstr)
+{
+  char* endPointer;
+  long long value;
+
+  errno = 0;
+  value = strtoll(string, &endPointer, 10);
+  if ((string[0] == 0) || (*endPointer != 0))
+  {
+    *errstr = "invalid";
+    return 0;
+  }
+  else if (((errno == ERANGE) && (value == LLONG_MIN)) ||
+           (value < minValue))
+  {
+    *errstr = "too small";
+    return 0;
+  }
+  else if (((errno == ERANGE) && (value == LLONG_MAX)) ||
+           (value > maxValue))
+  {
+    *errstr = "too large";
+    return 0;
+  }
+  *errstr = NULL;
+  return value;
+}
+
 static struct addrinfo* parseAddrPort(
   const char* optarg)
 {
@@ -92,26 +221,144 @@ fail:
   exit(1);
 }
 
+static uint64_t parseBytesPerSecond(
+  const char* optarg)
+{
+  const char* errstr;
+  const long long bytesPerSecond =
+    parseNumber(optarg, 0, MAX_BYTES_PER_SECOND, &errstr);
+  if (errstr != NULL)
+  {
+    proxyLog("invalid bytes per second argument '%s': %s", optarg, errstr);
+    exit(1);
+  }
+  return bytesPerSecond;
+}
+
+/* A listen address limit is split between the threads, each needs at
+   least 1 byte per second of it. */
+static void checkListenBytesPerSecond(
+  const struct ProxySettings* proxySettings)
+{
+  const struct ListenAddrInfo* listenAddrInfo;
+
+  SIMPLEQ_FOREACH(listenAddrInfo, proxySettings->listenAddrInfoList, entry)
+  {
+    if ((listenAddrInfo->bytesPerSecond > 0) &&
+        (listenAddrInfo->bytesPerSecond < proxySettings->numThreads))
+    {
+      proxyLog("listen bytes per second %ju less than %u threads",
+               (uintmax_t)listenAddrInfo->bytesPerSecond,
+               proxySettings->numThreads);
+      exit(1);
+    }
+  }
+}
+
 static void parseListenAddrPort(
   const char* optarg,
   struct ProxySettings* proxySettings)
 {
+  char addrPortString[NI_MAXHOST + NI_MAXSERV + 1];
+  const char* commaPointer = strchr(optarg, ',');
   struct ListenAddrInfo* listenAddrInfo =
     checkedCallocOne(sizeof(struct ListenAddrInfo));
 
+  if (commaPointer != NULL)
+  {
+    const size_t addrPortLength = commaPointer - optarg;
+    if (addrPortLength >= sizeof(addrPortString))
+    {
+      proxyLog("invalid address:port argument: '%s'", optarg);
+      exit(1);
+    }
+    memcpy(addrPortString, optarg, addrPortLength);
+    addrPortString[addrPortLength] = 0;
+
+    listenAddrInfo->bytesPerSecond = parseBytesPerSecond(commaPointer + 1);
+    optarg = addrPortString;
+  }
+
   listenAddrInfo->addrinfo = parseAddrPort(optarg);
+  listenAddrInfo->index = proxySettings->numListenAddrs;
+  ++(proxySettings->numListenAddrs);
 
   SIMPLEQ_INSERT_TAIL(
     proxySettings->listenAddrInfoList,
     listenAddrInfo, entry);
 }
 
+static uint32_t parseRemoteWeight(
+  const char* optarg)
+{
+  const char* errstr;
+  const long long weight =
+    parseNumber(optarg, 1, MAX_REMOTE_WEIGHT, &errstr);
+  if (errstr != NULL)
+  {
+    proxyLog("invalid remote weight argument '%s': %s", optarg, errstr);
+    exit(1);
+  }
+  return weight;
+}
+
+static uint32_t parseRemoteMaxSessions(
+  const char* optarg)
+{
+  const char* errstr;
+  const long long maxSessions =
+    parseNumber(optarg, 0, MAX_REMOTE_MAX_SESSIONS, &errstr);
+  if (errstr != NULL)
+  {
+    proxyLog("invalid remote max sessions argument '%s': %s", optarg, errstr);
+    exit(1);
+  }
+  return maxSessions;
+}
+
 static void parseRemoteAddrPort(
   const char* optarg,
   struct ProxySettings* proxySettings,
   size_t* remoteAddrInfoArrayCapacity)
 {
-  struct addrinfo* addressInfo = parseAddrPort(optarg);
+  char addrPortString[NI_MAXHOST + NI_MAXSERV + 1];
+  char weightString[16];
+  const char* commaPointer = strchr(optarg, ',');
+  uint32_t weight = DEFAULT_REMOTE_WEIGHT;
+  uint32_t maxSessions = DEFAULT_REMOTE_MAX_SESSIONS;
+  struct addrinfo* addressInfo;
+
+  if (commaPointer != NULL)
+  {
+    const size_t addrPortLength = commaPointer - optarg;
+    const char* weightPointer = commaPointer + 1;
+    const char* maxSessionsCommaPointer = strchr(weightPointer, ',');
+    if (addrPortLength >= sizeof(addrPortString))
+    {
+      proxyLog("invalid address:port argument: '%s'", optarg);
+      goto fail;
+    }
+    memcpy(addrPortString, optarg, addrPortLength);
+    addrPortString[addrPortLength] = 0;
+
+    if (maxSessionsCommaPointer != NULL)
+    {
+      const size_t weightLength = maxSessionsCommaPointer - weightPointer;
+      if (weightLength >= sizeof(weightString))
+      {
+        proxyLog("invalid remote weight argument: '%s'", optarg);
+        goto fail;
+      }
+      memcpy(weightString, weightPointer, weightLength);
+      weightString[weightLength] = 0;
+      weightPointer = weightString;
+      maxSessions = parseRemoteMaxSessions(maxSessionsCommaPointer + 1);
+    }
+    weight = parseRemoteWeight(weightPointer);
+    optarg = addrPortString;
+  }
+
+  addressInfo = parseAddrPort(optarg);
 
   while (addressInfo != NULL)
   {
@@ -131,6 +378,8 @@ static void parseRemoteAddrPort(
       proxySettings->remoteAddrInfoArrayLength - 1;
 
     remoteAddrInfo->addrinfo = addressInfo;
+    remoteAddrInfo->weight = weight;
+    remoteAddrInfo->maxSessions = maxSessions;
 
     if (!addrInfoToNameAndPort(
           addressInfo,
@@ -148,10 +397,59 @@ fail:
   exit(1);
 }
 
+static enum BalanceMode parseBalanceMode(char* optarg)
+{
+  if (strcmp(optarg, "random") == 0)
+  {
+    return BALANCE_RANDOM;
+  }
+  else if (strcmp(optarg, "leastconn") == 0)
+  {
+    return BALANCE_LEAST_CONN;
+  }
+  else if (strcmp(optarg, "p2c") == 0)
+  {
+    return BALANCE_P2C;
+  }
+  else if (strcmp(optarg, "maglev") == 0)
+  {
+    return BALANCE_MAGLEV;
+  }
+  else if (strcmp(optarg, "wrr") == 0)
+  {
+    return BALANCE_WEIGHTED_ROUND_ROBIN;
+  }
+  proxyLog("invalid balance mode argument '%s'", optarg);
+  exit(1);
+}
+
+static enum RelayMode parseRelayMode(char* optarg)
+{
+#ifdef SO_SPLICE
+  if (strcmp(optarg, "sosplice") == 0)
+  {
+    return RELAY_SO_SPLICE;
+  }
+#endif
+#ifdef SPLICE_F_MOVE
+  if (strcmp(optarg, "pipe") == 0)
+  {
+    return RELAY_PIPE;
+  }
+#endif
+  if (strcmp(optarg, "copy") == 0)
+  {
+    return RELAY_COPY;
+  }
+  proxyLog("invalid relay mode argument '%s'", optarg);
+  exit(1);
+}
+
 static uint32_t parseConnectTimeoutMS(char* optarg)
 {
   const char* errstr;
-  const long long connectTimeoutMS = strtonum(optarg, 1, 60 * 1000, &errstr);
+  const long long connectTimeoutMS =
+    parseNumber(optarg, 1, 60 * 1000, &errstr);
   if (errstr != NULL)
   {
     proxyLog("invalid connect timeout argument '%s': %s", optarg, errstr);
@@ -160,10 +458,37 @@ static uint32_t parseConnectTimeoutMS(char* optarg)
   return connectTimeoutMS;
 }
 
+static uint32_t parseConnectRetries(char* optarg)
+{
+  const char* errstr;
+  const long long connectRetries =
+    parseNumber(optarg, 0, MAX_CONNECT_RETRIES, &errstr);
+  if (errstr != NULL)
+  {
+    proxyLog("invalid connect retries argument '%s': %s", optarg, errstr);
+    exit(1);
+  }
+  return connectRetries;
+}
+
+static uint32_t parseRaceConnectDelayMS(char* optarg)
+{
+  const char* errstr;
+  const long long raceConnectDelayMS =
+    parseNumber(optarg, 0, 60 * 1000, &errstr);
+  if (errstr != NULL)
+  {
+    proxyLog("invalid race connect delay argument '%s': %s", optarg, errstr);
+    exit(1);
+  }
+  return raceConnectDelayMS;
+}
+
 static uint32_t parsePeriodicLogMS(char* optarg)
 {
   const char* errstr;
-  const long long periodicLogMS = strtonum(optarg, 0, 3600 * 1000, &errstr);
+  const long long periodicLogMS =
+    parseNumber(optarg, 0, 3600 * 1000, &errstr);
   if (errstr != NULL)
   {
     proxyLog("invalid periodic log timeout argument '%s': %s", optarg, errstr);
@@ -172,6 +497,167 @@ static uint32_t parsePeriodicLogMS(char* optarg)
   return periodicLogMS;
 }
 
+static uint32_t parseMaxEventsPerWait(char* optarg)
+{
+  const char* errstr;
+  const long long maxEventsPerWait =
+    parseNumber(optarg, 1, MAX_MAX_EVENTS_PER_WAIT, &errstr);
+  if (errstr != NULL)
+  {
+    proxyLog("invalid max events per wait argument '%s': %s", optarg, errstr);
+    exit(1);
+  }
+  return maxEventsPerWait;
+}
+
+static uint32_t parsePreallocatedSessions(char* optarg)
+{
+  const char* errstr;
+  const long long preallocatedSessions =
+    parseNumber(optarg, 0, MAX_PREALLOCATED_SESSIONS, &errstr);
+  if (errstr != NULL)
+  {
+    proxyLog("invalid preallocated sessions argument '%s': %s",
+             optarg, errstr);
+    exit(1);
+  }
+  return preallocatedSessions;
+}
+
+static uint32_t parseHealthCheckIntervalMS(char* optarg)
+{
+  const char* errstr;
+  const long long healthCheckIntervalMS =
+    parseNumber(optarg, 0, 3600 * 1000, &errstr);
+  if (errstr != NULL)
+  {
+    proxyLog("invalid health check interval argument '%s': %s",
+             optarg, errstr);
+    exit(1);
+  }
+  return healthCheckIntervalMS;
+}
+
+static uint32_t parseHealthCheckThreshold(char* optarg)
+{
+  const char* errstr;
+  const long long healthCheckThreshold =
+    parseNumber(optarg, 1, MAX_HEALTH_CHECK_THRESHOLD, &errstr);
+  if (errstr != NULL)
+  {
+    proxyLog("invalid health check threshold argument '%s': %s",
+             optarg, errstr);
+    exit(1);
+  }
+  return healthCheckThreshold;
+}
+
+static uint32_t parseOutlierConnectFailures(char* optarg)
+{
+  const char* errstr;
+  const long long outlierConnectFailures =
+    parseNumber(optarg, 0, MAX_OUTLIER_CONNECT_FAILURES, &errstr);
+  if (errstr != NULL)
+  {
+    proxyLog("invalid outlier connect failures argument '%s': %s",
+             optarg, errstr);
+    exit(1);
+  }
+  return outlierConnectFailures;
+}
+
+static uint32_t parseOutlierEjectionMS(char* optarg)
+{
+  const char* errstr;
+  const long long outlierEjectionMS =
+    parseNumber(optarg, 1, 300 * 1000, &errstr);
+  if (errstr != NULL)
+  {
+    proxyLog("invalid ejection time argument '%s': %s", optarg, errstr);
+    exit(1);
+  }
+  return outlierEjectionMS;
+}
+
+static uint32_t parseOutlierMaxEjectionPercent(char* optarg)
+{
+  const char* errstr;
+  const long long outlierMaxEjectionPercent =
+    parseNumber(optarg, 1, 100, &errstr);
+  if (errstr != NULL)
+  {
+    proxyLog("invalid max ejection percent argument '%s': %s",
+             optarg, errstr);
+    exit(1);
+  }
+  return outlierMaxEjectionPercent;
+}
+
+static uint32_t parseWarmConnections(char* optarg)
+{
+  const char* errstr;
+  const long long warmConnections =
+    parseNumber(optarg, 0, MAX_WARM_CONNECTIONS, &errstr);
+  if (errstr != NULL)
+  {
+    proxyLog("invalid warm connections argument '%s': %s", optarg, errstr);
+    exit(1);
+  }
+  return warmConnections;
+}
+
+static uint32_t parseWarmIdleMS(char* optarg)
+{
+  const char* errstr;
+  const long long warmIdleMS =
+    parseNumber(optarg, 1, 3600 * 1000, &errstr);
+  if (errstr != NULL)
+  {
+    proxyLog("invalid warm idle timeout argument '%s': %s", optarg, errstr);
+    exit(1);
+  }
+  return warmIdleMS;
+}
+
+static uint32_t parsePendingClients(char* optarg)
+{
+  const char* errstr;
+  const long long pendingClients =
+    parseNumber(optarg, 0, MAX_PENDING_CLIENTS, &errstr);
+  if (errstr != NULL)
+  {
+    proxyLog("invalid pending clients argument '%s': %s", optarg, errstr);
+    exit(1);
+  }
+  return pendingClients;
+}
+
+static uint32_t parsePendingClientMS(char* optarg)
+{
+  const char* errstr;
+  const long long pendingClientMS =
+    parseNumber(optarg, 1, 3600 * 1000, &errstr);
+  if (errstr != NULL)
+  {
+    proxyLog("invalid pending timeout argument '%s': %s", optarg, errstr);
+    exit(1);
+  }
+  return pendingClientMS;
+}
+
+static uint32_t parseNumThreads(char* optarg)
+{
+  const char* errstr;
+  const long long numThreads =
+    parseNumber(optarg, 1, MAX_NUM_THREADS, &errstr);
+  if (errstr != NULL)
+  {
+    proxyLog("invalid threads argument '%s': %s", optarg, errstr);
+    exit(1);
+  }
+  return numThreads;
+}
+
 const struct ProxySettings* processArgs(
   int argc,
   char** argv)
@@ -182,35 +668,134 @@ const struct ProxySettings* processArgs(
     checkedCallocOne(sizeof(struct ProxySettings));
 
   proxySettings->connectTimeoutMS = DEFAULT_CONNECT_TIMEOUT_MS;
+  proxySettings->connectRetries = DEFAULT_CONNECT_RETRIES;
+  proxySettings->raceConnectDelayMS = DEFAULT_RACE_CONNECT_DELAY_MS;
   proxySettings->periodicLogMS = DEFAULT_PERIODIC_LOG_MS;
+  proxySettings->numThreads = DEFAULT_NUM_THREADS;
+  proxySettings->maxEventsPerWait = DEFAULT_MAX_EVENTS_PER_WAIT;
+  proxySettings->preallocatedSessions = DEFAULT_PREALLOCATED_SESSIONS;
+  proxySettings->healthCheckIntervalMS = DEFAULT_HEALTH_CHECK_INTERVAL_MS;
+  proxySettings->healthCheckRise = DEFAULT_HEALTH_CHECK_RISE;
+  proxySettings->healthCheckFall = DEFAULT_HEALTH_CHECK_FALL;
+  proxySettings->outlierConnectFailures = DEFAULT_OUTLIER_CONNECT_FAILURES;
+  proxySettings->outlierEjectionMS = DEFAULT_OUTLIER_EJECTION_MS;
+  proxySettings->outlierMaxEjectionPercent =
+    DEFAULT_OUTLIER_MAX_EJECTION_PERCENT;
+  proxySettings->warmConnections = DEFAULT_WARM_CONNECTIONS;
+  proxySettings->warmIdleMS = DEFAULT_WARM_IDLE_MS;
+  proxySettings->pendingClients = DEFAULT_PENDING_CLIENTS;
+  proxySettings->pendingClientMS = DEFAULT_PENDING_CLIENT_MS;
+  proxySettings->relayMode = DEFAULT_RELAY_MODE;
   proxySettings->listenAddrInfoList =
     checkedCallocOne(sizeof(struct ListenAddrInfoList));
   SIMPLEQ_INIT(proxySettings->listenAddrInfoList);
 
-  while ((retVal = getopt(argc, argv, "c:fl:p:r:")) != -1)
+  while ((retVal = getopt(argc, argv, "ab:c:d:e:fg:i:j:k:l:m:n:o:p:qr:s:t:u:v:w:x:y:z:")) != -1)
   {
     switch (retVal)
     {
+    case 'a':
+      proxySettings->acceptorThread = true;
+      break;
+
+    case 'b':
+      proxySettings->balanceMode = parseBalanceMode(optarg);
+      break;
+
     case 'c':
       proxySettings->connectTimeoutMS = parseConnectTimeoutMS(optarg);
       break;
 
+    case 'd':
+      proxySettings->healthCheckFall = parseHealthCheckThreshold(optarg);
+      break;
+
+    case 'e':
+      proxySettings->maxEventsPerWait = parseMaxEventsPerWait(optarg);
+      break;
+
     case 'f':
       proxySettings->flushAfterLog = true;
       break;
 
+    case 'g':
+      proxySettings->pendingClients = parsePendingClients(optarg);
+      break;
+
+    case 'i':
+      proxySettings->healthCheckIntervalMS = parseHealthCheckIntervalMS(optarg);
+      break;
+
+    case 'j':
+      proxySettings->outlierEjectionMS = parseOutlierEjectionMS(optarg);
+      break;
+
+    case 'k':
+      proxySettings->warmIdleMS = parseWarmIdleMS(optarg);
+      break;
+
     case 'l':
       parseListenAddrPort(optarg, proxySettings);
       break;
 
+    case 'm':
+      proxySettings->outlierMaxEjectionPercent =
+        parseOutlierMaxEjectionPercent(optarg);
+      break;
+
+    case 'n':
+      proxySettings->preallocatedSessions = parsePreallocatedSessions(optarg);
+      break;
+
+    case 'o':
+      proxySettings->outlierConnectFailures =
+        parseOutlierConnectFailures(optarg);
+      break;
+
     case 'p':
       proxySettings->periodicLogMS = parsePeriodicLogMS(optarg);
       break;
 
+    case 'q':
+      proxySettings->quiet = true;
+      break;
+
     case 'r':
       parseRemoteAddrPort(optarg, proxySettings, &remoteAddrInfoArrayCapacity);
       break;
 
+    case 's':
+      proxySettings->pendingClientMS = parsePendingClientMS(optarg);
+      break;
+
+    case 't':
+      proxySettings->numThreads = parseNumThreads(optarg);
+      break;
+
+    case 'u':
+      proxySettings->healthCheckRise = parseHealthCheckThreshold(optarg);
+      break;
+
+    case 'v':
+      proxySettings->sessionBytesPerSecond = parseBytesPerSecond(optarg);
+      break;
+
+    case 'w':
+      proxySettings->warmConnections = parseWarmConnections(optarg);
+      break;
+
+    case 'x':
+      proxySettings->connectRetries = parseConnectRetries(optarg);
+      break;
+
+    case 'y':
+      proxySettings->raceConnectDelayMS = parseRaceConnectDelayMS(optarg);
+      break;
+
+    case 'z':
+      proxySettings->relayMode = parseRelayMode(optarg);
+      break;
+
     default:
       goto fail;
       break;
@@ -223,6 +808,8 @@ const struct ProxySettings* processArgs(
     goto fail;
   }
 
+  checkListenBytesPerSecond(proxySettings);
+
   return proxySettings;
 
 fail:
@@ -8,6 +8,9 @@
 struct ListenAddrInfo
 {
   struct addrinfo* addrinfo;
+  uint32_t index;
+  /* Per direction for all its sessions together, 0 = no limit */
+  uint64_t bytesPerSecond;
   SIMPLEQ_ENTRY(ListenAddrInfo) entry;
 };
 
@@ -17,16 +20,58 @@ struct RemoteAddrInfo
 {
   struct addrinfo* addrinfo;
   struct AddrPortStrings addrPortStrings;
+  uint32_t weight;
+  uint32_t maxSessions;
+};
+
+enum BalanceMode
+{
+  BALANCE_RANDOM,
+  BALANCE_LEAST_CONN,
+  BALANCE_P2C,
+  BALANCE_MAGLEV,
+  BALANCE_WEIGHTED_ROUND_ROBIN
+};
+
+/* RELAY_SO_SPLICE needs OpenBSD SO_SPLICE, RELAY_PIPE needs Linux
+   splice(2), RELAY_COPY works anywhere. */
+enum RelayMode
+{
+  RELAY_SO_SPLICE,
+  RELAY_COPY,
+  RELAY_PIPE
 };
 
 struct ProxySettings
 {
   struct ListenAddrInfoList* listenAddrInfoList;
+  uint32_t numListenAddrs;
   struct RemoteAddrInfo* remoteAddrInfoArray;
   size_t remoteAddrInfoArrayLength;
   uint32_t connectTimeoutMS;
+  uint32_t connectRetries;
+  uint32_t raceConnectDelayMS;
   uint32_t periodicLogMS;
+  uint32_t numThreads;
+  uint32_t maxEventsPerWait;
+  uint32_t preallocatedSessions;
+  uint32_t healthCheckIntervalMS;
+  uint32_t healthCheckRise;
+  uint32_t healthCheckFall;
+  uint32_t outlierConnectFailures;
+  uint32_t outlierEjectionMS;
+  uint32_t outlierMaxEjectionPercent;
+  uint32_t warmConnections;
+  uint32_t warmIdleMS;
+  uint32_t pendingClients;
+  uint32_t pendingClientMS;
+  /* Per session in each direction, 0 = no limit */
+  uint64_t sessionBytesPerSecond;
+  enum BalanceMode balanceMode;
+  enum RelayMode relayMode;
+  bool acceptorThread;
   bool flushAfterLog;
+  bool quiet;
 };
 
 const struct ProxySettings* processArgs(
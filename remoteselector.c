@@ -0,0 +1,776 @@
+#include "remoteselector.h"
+#include "hashutil.h"
+#include "maglev.h"
+#include "memutil.h"
+#include "timeutil.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * For BALANCE_LEAST_CONN the remotes are kept in a binary min-heap keyed
+ * by session count, with each remote's heap position tracked so a count
+ * change only sifts that one entry.  Choosing is O(1), adding or removing
+ * a session O(log remotes).
+ *
+ * BALANCE_P2C samples two distinct remotes and takes the one with the
+ * lower (sessions + 1) * (connect time EWMA + 1).  A remote with no
+ * connect measured yet scores lowest, so it is tried soon.
+ *
+ * BALANCE_MAGLEV hashes the client IP address, without the port, into a
+ * Maglev table built from the remote address:port strings.
+ *
+ * BALANCE_WEIGHTED_ROUND_ROBIN is smooth weighted round robin: every pick
+ * adds each remote's weight to its current value, takes the largest and
+ * subtracts the weight total from it.  Weights 5,1,1 give a a b a c a a
+ * rather than five picks of a in a row.
+ *
+ * Every mode only picks eligible remotes, ones that are healthy and not
+ * ejected.  Ineligible remotes sort after all eligible ones in the least
+ * connections heap and are left out of the Maglev table.  If no remote is
+ * eligible all of them are used, a connect attempt is better than
+ * refusing every client.  A connect retry also leaves out the remote that
+ * just failed, unless nothing else is left.
+ *
+ * A remote with maxSessions sessions is never chosen.  When the balance
+ * mode picks one, the next candidate after it with room is taken.  There
+ * is no failing open here, with every candidate full no remote is chosen
+ * and the caller holds the client back.
+ *
+ * Outlier ejection counts consecutive failed connects.  Reaching
+ * outlierConnectFailures ejects the remote for outlierEjectionMS doubled
+ * for every earlier ejection, unless that would eject more than
+ * outlierMaxEjectionPercent of the remotes.  A remote that stays in for
+ * as long as its last ejection lasted starts over at outlierEjectionMS.
+ */
+
+/* EWMA weight of a new connect time sample, 1/2^EWMA_SHIFT */
+#define EWMA_SHIFT (3)
+
+#define MAX_OUTLIER_EJECTION_MS (300 * 1000)
+
+struct RemoteOutlierState
+{
+  uint32_t numConsecutiveFailures;
+  uint32_t numEjections;
+  uint32_t lastEjectionMS;
+  uint64_t lastEjectionEndTimeMS;
+  bool ejected;
+};
+
+struct RemoteSelector
+{
+  enum BalanceMode balanceMode;
+  size_t numRemotes;
+  size_t* numSessionsArray;
+  uint64_t* connectTimeEWMAArray;
+  const struct RemoteAddrInfo* remoteAddrInfoArray;
+  int64_t* currentWeightArray;
+  bool* healthyArray;
+  struct RemoteOutlierState* outlierStateArray;
+  uint32_t outlierConnectFailures;
+  uint32_t outlierEjectionMS;
+  size_t maxEjected;
+  size_t numEjected;
+  bool* eligibleArray;
+  size_t numEligible;
+  size_t* heapArray;
+  size_t* heapPositionArray;
+  struct MaglevTable* maglevTable;
+};
+
+static bool isRemoteSelectable(
+  const struct RemoteSelector* remoteSelector,
+  size_t remoteIndex)
+{
+  return ((remoteSelector->numEligible == 0) ||
+          remoteSelector->eligibleArray[remoteIndex]);
+}
+
+static bool isRemoteFull(
+  const struct RemoteSelector* remoteSelector,
+  size_t remoteIndex)
+{
+  const uint32_t maxSessions =
+    remoteSelector->remoteAddrInfoArray[remoteIndex].maxSessions;
+
+  return ((maxSessions != 0) &&
+          (remoteSelector->numSessionsArray[remoteIndex] >= maxSessions));
+}
+
+static bool isRemoteCandidate(
+  const struct RemoteSelector* remoteSelector,
+  size_t remoteIndex,
+  size_t excludeRemoteIndex)
+{
+  return ((remoteIndex != excludeRemoteIndex) &&
+          isRemoteSelectable(remoteSelector, remoteIndex));
+}
+
+static size_t getNumCandidateRemotes(
+  const struct RemoteSelector* remoteSelector,
+  size_t excludeRemoteIndex)
+{
+  size_t numCandidates = remoteSelector->numEligible;
+
+  if (numCandidates == 0)
+  {
+    numCandidates = remoteSelector->numRemotes;
+  }
+  if ((excludeRemoteIndex != NO_REMOTE_INDEX) &&
+      isRemoteSelectable(remoteSelector, excludeRemoteIndex))
+  {
+    --numCandidates;
+  }
+  return numCandidates;
+}
+
+/* Maps n in [0, getNumCandidateRemotes()) to a remote index. */
+static size_t getCandidateRemoteIndex(
+  const struct RemoteSelector* remoteSelector,
+  size_t n,
+  size_t excludeRemoteIndex)
+{
+  size_t i;
+
+  if ((remoteSelector->numEligible == 0) ||
+      (remoteSelector->numEligible == remoteSelector->numRemotes))
+  {
+    return (((excludeRemoteIndex != NO_REMOTE_INDEX) &&
+             (n >= excludeRemoteIndex)) ? (n + 1) : n);
+  }
+
+  for (i = 0; i < remoteSelector->numRemotes; ++i)
+  {
+    if (isRemoteCandidate(remoteSelector, i, excludeRemoteIndex))
+    {
+      if (n == 0)
+      {
+        break;
+      }
+      --n;
+    }
+  }
+  return i;
+}
+
+/* Eligible remotes first, then fewest sessions. */
+static bool heapLess(
+  const struct RemoteSelector* remoteSelector,
+  size_t heapPosition1,
+  size_t heapPosition2)
+{
+  const size_t remoteIndex1 = remoteSelector->heapArray[heapPosition1];
+  const size_t remoteIndex2 = remoteSelector->heapArray[heapPosition2];
+
+  if (remoteSelector->eligibleArray[remoteIndex1] !=
+      remoteSelector->eligibleArray[remoteIndex2])
+  {
+    return remoteSelector->eligibleArray[remoteIndex1];
+  }
+  return (remoteSelector->numSessionsArray[remoteIndex1] <
+          remoteSelector->numSessionsArray[remoteIndex2]);
+}
+
+static void heapSwap(
+  struct RemoteSelector* remoteSelector,
+  size_t heapPosition1,
+  size_t heapPosition2)
+{
+  const size_t remoteIndex1 = remoteSelector->heapArray[heapPosition1];
+  const size_t remoteIndex2 = remoteSelector->heapArray[heapPosition2];
+
+  remoteSelector->heapArray[heapPosition1] = remoteIndex2;
+  remoteSelector->heapArray[heapPosition2] = remoteIndex1;
+  remoteSelector->heapPositionArray[remoteIndex2] = heapPosition1;
+  remoteSelector->heapPositionArray[remoteIndex1] = heapPosition2;
+}
+
+static void heapSiftUp(
+  struct RemoteSelector* remoteSelector,
+  size_t heapPosition)
+{
+  while (heapPosition > 0)
+  {
+    const size_t parentPosition = (heapPosition - 1) / 2;
+    if (!heapLess(remoteSelector, heapPosition, parentPosition))
+    {
+      break;
+    }
+    heapSwap(remoteSelector, heapPosition, parentPosition);
+    heapPosition = parentPosition;
+  }
+}
+
+static void heapSiftDown(
+  struct RemoteSelector* remoteSelector,
+  size_t heapPosition)
+{
+  while (true)
+  {
+    const size_t leftPosition = (2 * heapPosition) + 1;
+    const size_t rightPosition = leftPosition + 1;
+    size_t minPosition = heapPosition;
+
+    if ((leftPosition < remoteSelector->numRemotes) &&
+        heapLess(remoteSelector, leftPosition, minPosition))
+    {
+      minPosition = leftPosition;
+    }
+    if ((rightPosition < remoteSelector->numRemotes) &&
+        heapLess(remoteSelector, rightPosition, minPosition))
+    {
+      minPosition = rightPosition;
+    }
+    if (minPosition == heapPosition)
+    {
+      break;
+    }
+    heapSwap(remoteSelector, heapPosition, minPosition);
+    heapPosition = minPosition;
+  }
+}
+
+static struct MaglevTable* newRemoteMaglevTable(
+  const struct ProxySettings* proxySettings)
+{
+  const size_t numRemotes = proxySettings->remoteAddrInfoArrayLength;
+  uint64_t* nameHashArray =
+    checkedReallocarray(NULL, numRemotes, sizeof(uint64_t));
+  struct MaglevTable* maglevTable;
+  size_t i;
+
+  for (i = 0; i < numRemotes; ++i)
+  {
+    const struct AddrPortStrings* addrPortStrings =
+      &(proxySettings->remoteAddrInfoArray[i].addrPortStrings);
+    const uint64_t addrHash =
+      hashBytes(addrPortStrings->addrString,
+                strlen(addrPortStrings->addrString), 0);
+    nameHashArray[i] =
+      hashBytes(addrPortStrings->portString,
+                strlen(addrPortStrings->portString), addrHash);
+  }
+
+  maglevTable = newMaglevTable(nameHashArray, numRemotes);
+
+  free(nameHashArray);
+
+  return maglevTable;
+}
+
+struct RemoteSelector* newRemoteSelector(
+  const struct ProxySettings* proxySettings)
+{
+  struct RemoteSelector* remoteSelector =
+    checkedCallocOne(sizeof(struct RemoteSelector));
+  size_t i;
+
+  remoteSelector->balanceMode = proxySettings->balanceMode;
+  remoteSelector->numRemotes = proxySettings->remoteAddrInfoArrayLength;
+
+  remoteSelector->numSessionsArray =
+    checkedReallocarray(NULL, remoteSelector->numRemotes, sizeof(size_t));
+  remoteSelector->connectTimeEWMAArray =
+    checkedReallocarray(NULL, remoteSelector->numRemotes, sizeof(uint64_t));
+  remoteSelector->remoteAddrInfoArray = proxySettings->remoteAddrInfoArray;
+  remoteSelector->currentWeightArray =
+    checkedReallocarray(NULL, remoteSelector->numRemotes, sizeof(int64_t));
+  remoteSelector->healthyArray =
+    checkedReallocarray(NULL, remoteSelector->numRemotes, sizeof(bool));
+  remoteSelector->outlierStateArray =
+    checkedReallocarray(NULL, remoteSelector->numRemotes,
+                        sizeof(struct RemoteOutlierState));
+  remoteSelector->eligibleArray =
+    checkedReallocarray(NULL, remoteSelector->numRemotes, sizeof(bool));
+  remoteSelector->heapArray =
+    checkedReallocarray(NULL, remoteSelector->numRemotes, sizeof(size_t));
+  remoteSelector->heapPositionArray =
+    checkedReallocarray(NULL, remoteSelector->numRemotes, sizeof(size_t));
+
+  for (i = 0; i < remoteSelector->numRemotes; ++i)
+  {
+    remoteSelector->numSessionsArray[i] = 0;
+    remoteSelector->connectTimeEWMAArray[i] = 0;
+    remoteSelector->currentWeightArray[i] = 0;
+    remoteSelector->healthyArray[i] = true;
+    memset(remoteSelector->outlierStateArray + i, 0,
+           sizeof(struct RemoteOutlierState));
+    remoteSelector->eligibleArray[i] = true;
+    remoteSelector->heapArray[i] = i;
+    remoteSelector->heapPositionArray[i] = i;
+  }
+  remoteSelector->numEligible = remoteSelector->numRemotes;
+
+  remoteSelector->outlierConnectFailures =
+    proxySettings->outlierConnectFailures;
+  remoteSelector->outlierEjectionMS = proxySettings->outlierEjectionMS;
+  remoteSelector->maxEjected =
+    (remoteSelector->numRemotes *
+     proxySettings->outlierMaxEjectionPercent) / 100;
+  if (remoteSelector->maxEjected == 0)
+  {
+    remoteSelector->maxEjected = 1;
+  }
+
+  if (remoteSelector->balanceMode == BALANCE_MAGLEV)
+  {
+    remoteSelector->maglevTable = newRemoteMaglevTable(proxySettings);
+  }
+
+  return remoteSelector;
+}
+
+static uint64_t getP2CScore(
+  const struct RemoteSelector* remoteSelector,
+  size_t remoteIndex)
+{
+  return ((remoteSelector->numSessionsArray[remoteIndex] + 1) *
+          (remoteSelector->connectTimeEWMAArray[remoteIndex] + 1));
+}
+
+static size_t chooseP2CRemoteIndex(
+  const struct RemoteSelector* remoteSelector,
+  size_t excludeRemoteIndex)
+{
+  const size_t numCandidates =
+    getNumCandidateRemotes(remoteSelector, excludeRemoteIndex);
+  size_t n1;
+  size_t n2;
+  size_t remoteIndex1;
+  size_t remoteIndex2;
+
+  if (numCandidates < 2)
+  {
+    return getCandidateRemoteIndex(remoteSelector, 0, excludeRemoteIndex);
+  }
+
+  n1 = arc4random_uniform(numCandidates);
+  n2 = arc4random_uniform(numCandidates - 1);
+  if (n2 >= n1)
+  {
+    ++n2;
+  }
+  remoteIndex1 = getCandidateRemoteIndex(remoteSelector, n1,
+                                         excludeRemoteIndex);
+  remoteIndex2 = getCandidateRemoteIndex(remoteSelector, n2,
+                                         excludeRemoteIndex);
+
+  if (getP2CScore(remoteSelector, remoteIndex2) <
+      getP2CScore(remoteSelector, remoteIndex1))
+  {
+    return remoteIndex2;
+  }
+  return remoteIndex1;
+}
+
+static size_t chooseRandomRemoteIndex(
+  const struct RemoteSelector* remoteSelector,
+  size_t excludeRemoteIndex)
+{
+  return getCandidateRemoteIndex(
+    remoteSelector,
+    arc4random_uniform(getNumCandidateRemotes(remoteSelector,
+                                              excludeRemoteIndex)),
+    excludeRemoteIndex);
+}
+
+static size_t chooseLeastConnRemoteIndex(
+  const struct RemoteSelector* remoteSelector,
+  size_t excludeRemoteIndex)
+{
+  size_t heapPosition = 0;
+
+  /* the runner up is one of the root's children */
+  if (remoteSelector->heapArray[0] == excludeRemoteIndex)
+  {
+    heapPosition = 1;
+    if ((remoteSelector->numRemotes > 2) &&
+        heapLess(remoteSelector, 2, 1))
+    {
+      heapPosition = 2;
+    }
+  }
+  return remoteSelector->heapArray[heapPosition];
+}
+
+/* A retry does not rehash, the client's remote is the one that failed. */
+static size_t chooseMaglevRemoteIndex(
+  const struct RemoteSelector* remoteSelector,
+  const struct CompactSockAddr* clientSockAddr,
+  size_t excludeRemoteIndex)
+{
+  uint64_t clientHash;
+
+  if (excludeRemoteIndex != NO_REMOTE_INDEX)
+  {
+    return chooseRandomRemoteIndex(remoteSelector, excludeRemoteIndex);
+  }
+
+  if (clientSockAddr->sa.sa_family == AF_INET)
+  {
+    clientHash = hashBytes(&(clientSockAddr->sin.sin_addr),
+                           sizeof(clientSockAddr->sin.sin_addr), 0);
+  }
+  else if (clientSockAddr->sa.sa_family == AF_INET6)
+  {
+    clientHash = hashBytes(&(clientSockAddr->sin6.sin6_addr),
+                           sizeof(clientSockAddr->sin6.sin6_addr), 0);
+  }
+  else
+  {
+    return chooseRandomRemoteIndex(remoteSelector, NO_REMOTE_INDEX);
+  }
+
+  return lookupMaglevTable(remoteSelector->maglevTable, clientHash);
+}
+
+static size_t chooseWeightedRoundRobinRemoteIndex(
+  struct RemoteSelector* remoteSelector,
+  size_t excludeRemoteIndex)
+{
+  size_t bestRemoteIndex = SIZE_MAX;
+  int64_t totalWeight = 0;
+  size_t i;
+
+  for (i = 0; i < remoteSelector->numRemotes; ++i)
+  {
+    if (!isRemoteCandidate(remoteSelector, i, excludeRemoteIndex))
+    {
+      continue;
+    }
+    remoteSelector->currentWeightArray[i] +=
+      remoteSelector->remoteAddrInfoArray[i].weight;
+    totalWeight += remoteSelector->remoteAddrInfoArray[i].weight;
+    if ((bestRemoteIndex == SIZE_MAX) ||
+        (remoteSelector->currentWeightArray[i] >
+         remoteSelector->currentWeightArray[bestRemoteIndex]))
+    {
+      bestRemoteIndex = i;
+    }
+  }
+
+  remoteSelector->currentWeightArray[bestRemoteIndex] -= totalWeight;
+
+  return bestRemoteIndex;
+}
+
+static size_t chooseBalancedRemoteIndex(
+  struct RemoteSelector* remoteSelector,
+  const struct CompactSockAddr* clientSockAddr,
+  size_t excludeRemoteIndex)
+{
+  switch (remoteSelector->balanceMode)
+  {
+  case BALANCE_LEAST_CONN:
+    return chooseLeastConnRemoteIndex(remoteSelector, excludeRemoteIndex);
+
+  case BALANCE_P2C:
+    return chooseP2CRemoteIndex(remoteSelector, excludeRemoteIndex);
+
+  case BALANCE_MAGLEV:
+    return chooseMaglevRemoteIndex(remoteSelector, clientSockAddr,
+                                   excludeRemoteIndex);
+
+  case BALANCE_WEIGHTED_ROUND_ROBIN:
+    return chooseWeightedRoundRobinRemoteIndex(remoteSelector,
+                                               excludeRemoteIndex);
+
+  case BALANCE_RANDOM:
+  default:
+    return chooseRandomRemoteIndex(remoteSelector, excludeRemoteIndex);
+  }
+}
+
+static size_t chooseNextNotFullRemoteIndex(
+  const struct RemoteSelector* remoteSelector,
+  size_t fullRemoteIndex,
+  size_t excludeRemoteIndex)
+{
+  size_t i;
+
+  for (i = 1; i < remoteSelector->numRemotes; ++i)
+  {
+    const size_t remoteIndex =
+      (fullRemoteIndex + i) % remoteSelector->numRemotes;
+    if (isRemoteCandidate(remoteSelector, remoteIndex, excludeRemoteIndex) &&
+        (!isRemoteFull(remoteSelector, remoteIndex)))
+    {
+      return remoteIndex;
+    }
+  }
+  return NO_REMOTE_INDEX;
+}
+
+size_t chooseRemoteIndex(
+  struct RemoteSelector* remoteSelector,
+  const struct CompactSockAddr* clientSockAddr,
+  size_t excludeRemoteIndex)
+{
+  size_t remoteIndex;
+
+  assert(remoteSelector != NULL);
+
+  if ((excludeRemoteIndex != NO_REMOTE_INDEX) &&
+      (getNumCandidateRemotes(remoteSelector, excludeRemoteIndex) == 0))
+  {
+    excludeRemoteIndex = NO_REMOTE_INDEX;
+  }
+
+  remoteIndex = chooseBalancedRemoteIndex(remoteSelector, clientSockAddr,
+                                          excludeRemoteIndex);
+  if (isRemoteFull(remoteSelector, remoteIndex))
+  {
+    remoteIndex = chooseNextNotFullRemoteIndex(remoteSelector, remoteIndex,
+                                               excludeRemoteIndex);
+  }
+
+  return remoteIndex;
+}
+
+void addRemoteSession(
+  struct RemoteSelector* remoteSelector,
+  size_t remoteIndex)
+{
+  assert(remoteSelector != NULL);
+  assert(remoteIndex < remoteSelector->numRemotes);
+
+  ++(remoteSelector->numSessionsArray[remoteIndex]);
+
+  if (remoteSelector->balanceMode == BALANCE_LEAST_CONN)
+  {
+    heapSiftDown(remoteSelector,
+                 remoteSelector->heapPositionArray[remoteIndex]);
+  }
+}
+
+void removeRemoteSession(
+  struct RemoteSelector* remoteSelector,
+  size_t remoteIndex)
+{
+  assert(remoteSelector != NULL);
+  assert(remoteIndex < remoteSelector->numRemotes);
+  assert(remoteSelector->numSessionsArray[remoteIndex] > 0);
+
+  --(remoteSelector->numSessionsArray[remoteIndex]);
+
+  if (remoteSelector->balanceMode == BALANCE_LEAST_CONN)
+  {
+    heapSiftUp(remoteSelector,
+               remoteSelector->heapPositionArray[remoteIndex]);
+  }
+}
+
+void addRemoteConnectTime(
+  struct RemoteSelector* remoteSelector,
+  size_t remoteIndex,
+  uint64_t connectTimeUS)
+{
+  uint64_t* connectTimeEWMA;
+
+  assert(remoteSelector != NULL);
+  assert(remoteIndex < remoteSelector->numRemotes);
+
+  connectTimeEWMA = remoteSelector->connectTimeEWMAArray + remoteIndex;
+
+  if ((*connectTimeEWMA) == 0)
+  {
+    *connectTimeEWMA = connectTimeUS;
+  }
+  else
+  {
+    *connectTimeEWMA =
+      (*connectTimeEWMA) -
+      ((*connectTimeEWMA) >> EWMA_SHIFT) +
+      (connectTimeUS >> EWMA_SHIFT);
+  }
+}
+
+uint64_t getRemoteConnectTimeEWMA(
+  const struct RemoteSelector* remoteSelector,
+  size_t remoteIndex)
+{
+  assert(remoteSelector != NULL);
+  assert(remoteIndex < remoteSelector->numRemotes);
+
+  return remoteSelector->connectTimeEWMAArray[remoteIndex];
+}
+
+size_t getRemoteNumSessions(
+  const struct RemoteSelector* remoteSelector,
+  size_t remoteIndex)
+{
+  assert(remoteSelector != NULL);
+  assert(remoteIndex < remoteSelector->numRemotes);
+
+  return remoteSelector->numSessionsArray[remoteIndex];
+}
+
+static void populateRemoteMaglevTable(
+  struct RemoteSelector* remoteSelector)
+{
+  populateMaglevTable(
+    remoteSelector->maglevTable,
+    ((remoteSelector->numEligible == 0) ?
+     NULL : remoteSelector->eligibleArray));
+}
+
+static void updateRemoteEligible(
+  struct RemoteSelector* remoteSelector,
+  size_t remoteIndex)
+{
+  const bool eligible =
+    (remoteSelector->healthyArray[remoteIndex] &&
+     (!remoteSelector->outlierStateArray[remoteIndex].ejected));
+
+  if (remoteSelector->eligibleArray[remoteIndex] == eligible)
+  {
+    return;
+  }
+
+  remoteSelector->eligibleArray[remoteIndex] = eligible;
+  if (eligible)
+  {
+    ++(remoteSelector->numEligible);
+  }
+  else
+  {
+    --(remoteSelector->numEligible);
+  }
+
+  if (remoteSelector->balanceMode == BALANCE_LEAST_CONN)
+  {
+    heapSiftUp(remoteSelector,
+               remoteSelector->heapPositionArray[remoteIndex]);
+    heapSiftDown(remoteSelector,
+                 remoteSelector->heapPositionArray[remoteIndex]);
+  }
+  else if (remoteSelector->balanceMode == BALANCE_MAGLEV)
+  {
+    populateRemoteMaglevTable(remoteSelector);
+  }
+}
+
+void setRemoteHealthy(
+  struct RemoteSelector* remoteSelector,
+  size_t remoteIndex,
+  bool healthy)
+{
+  assert(remoteSelector != NULL);
+  assert(remoteIndex < remoteSelector->numRemotes);
+
+  remoteSelector->healthyArray[remoteIndex] = healthy;
+  updateRemoteEligible(remoteSelector, remoteIndex);
+}
+
+bool isRemoteHealthy(
+  const struct RemoteSelector* remoteSelector,
+  size_t remoteIndex)
+{
+  assert(remoteSelector != NULL);
+  assert(remoteIndex < remoteSelector->numRemotes);
+
+  return remoteSelector->healthyArray[remoteIndex];
+}
+
+static uint32_t getRemoteEjectionMS(
+  const struct RemoteSelector* remoteSelector,
+  const struct RemoteOutlierState* outlierState)
+{
+  uint64_t ejectionMS = remoteSelector->outlierEjectionMS;
+  uint32_t i;
+
+  for (i = 0;
+       (i < outlierState->numEjections) &&
+       (ejectionMS < MAX_OUTLIER_EJECTION_MS);
+       ++i)
+  {
+    ejectionMS *= 2;
+  }
+
+  if (ejectionMS > MAX_OUTLIER_EJECTION_MS)
+  {
+    ejectionMS = MAX_OUTLIER_EJECTION_MS;
+  }
+  return ejectionMS;
+}
+
+uint32_t addRemoteConnectResult(
+  struct RemoteSelector* remoteSelector,
+  size_t remoteIndex,
+  bool connected)
+{
+  struct RemoteOutlierState* outlierState;
+  uint64_t nowMS;
+
+  assert(remoteSelector != NULL);
+  assert(remoteIndex < remoteSelector->numRemotes);
+
+  outlierState = remoteSelector->outlierStateArray + remoteIndex;
+
+  if (connected)
+  {
+    outlierState->numConsecutiveFailures = 0;
+    return 0;
+  }
+
+  ++(outlierState->numConsecutiveFailures);
+
+  if ((remoteSelector->outlierConnectFailures == 0) ||
+      (outlierState->numConsecutiveFailures <
+       remoteSelector->outlierConnectFailures) ||
+      outlierState->ejected ||
+      (remoteSelector->numEjected >= remoteSelector->maxEjected))
+  {
+    return 0;
+  }
+
+  nowMS = getMonotonicTimeMS();
+  if ((outlierState->numEjections > 0) &&
+      ((nowMS - outlierState->lastEjectionEndTimeMS) >=
+       outlierState->lastEjectionMS))
+  {
+    outlierState->numEjections = 0;
+  }
+
+  outlierState->lastEjectionMS =
+    getRemoteEjectionMS(remoteSelector, outlierState);
+  ++(outlierState->numEjections);
+  outlierState->numConsecutiveFailures = 0;
+  outlierState->ejected = true;
+  ++(remoteSelector->numEjected);
+  updateRemoteEligible(remoteSelector, remoteIndex);
+
+  return outlierState->lastEjectionMS;
+}
+
+void endRemoteEjection(
+  struct RemoteSelector* remoteSelector,
+  size_t remoteIndex)
+{
+  struct RemoteOutlierState* outlierState;
+
+  assert(remoteSelector != NULL);
+  assert(remoteIndex < remoteSelector->numRemotes);
+
+  outlierState = remoteSelector->outlierStateArray + remoteIndex;
+  if (!outlierState->ejected)
+  {
+    return;
+  }
+
+  outlierState->ejected = false;
+  outlierState->lastEjectionEndTimeMS = getMonotonicTimeMS();
+  --(remoteSelector->numEjected);
+  updateRemoteEligible(remoteSelector, remoteIndex);
+}
+
+bool isRemoteEjected(
+  const struct RemoteSelector* remoteSelector,
+  size_t remoteIndex)
+{
+  assert(remoteSelector != NULL);
+  assert(remoteIndex < remoteSelector->numRemotes);
+
+  return remoteSelector->outlierStateArray[remoteIndex].ejected;
+}
@@ -0,0 +1,76 @@
+#ifndef REMOTESELECTOR_H
+#define REMOTESELECTOR_H
+
+#include "proxysettings.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Per thread choice of remote address for new sessions, and the live
+   session count of each remote.  Remotes are identified by their index
+   in ProxySettings remoteAddrInfoArray. */
+struct RemoteSelector;
+
+#define NO_REMOTE_INDEX (SIZE_MAX)
+
+struct RemoteSelector* newRemoteSelector(
+  const struct ProxySettings* proxySettings);
+
+/* excludeRemoteIndex is only chosen if no other remote can be, pass
+   NO_REMOTE_INDEX to consider every remote.  Returns NO_REMOTE_INDEX if
+   every remote that could be chosen is at its maxSessions. */
+size_t chooseRemoteIndex(
+  struct RemoteSelector* remoteSelector,
+  const struct CompactSockAddr* clientSockAddr,
+  size_t excludeRemoteIndex);
+
+void addRemoteSession(
+  struct RemoteSelector* remoteSelector,
+  size_t remoteIndex);
+
+void removeRemoteSession(
+  struct RemoteSelector* remoteSelector,
+  size_t remoteIndex);
+
+/* Feeds the remote's moving average of connect completion time. */
+void addRemoteConnectTime(
+  struct RemoteSelector* remoteSelector,
+  size_t remoteIndex,
+  uint64_t connectTimeUS);
+
+uint64_t getRemoteConnectTimeEWMA(
+  const struct RemoteSelector* remoteSelector,
+  size_t remoteIndex);
+
+size_t getRemoteNumSessions(
+  const struct RemoteSelector* remoteSelector,
+  size_t remoteIndex);
+
+/* Remotes start healthy.  Unhealthy or ejected remotes are not chosen
+   unless every remote is. */
+void setRemoteHealthy(
+  struct RemoteSelector* remoteSelector,
+  size_t remoteIndex,
+  bool healthy);
+
+bool isRemoteHealthy(
+  const struct RemoteSelector* remoteSelector,
+  size_t remoteIndex);
+
+/* Counts consecutive failed connects for outlier ejection.  Returns the
+   milliseconds the remote has just been ejected for, or 0.  The caller
+   ends the ejection with endRemoteEjection() once that time has passed. */
+uint32_t addRemoteConnectResult(
+  struct RemoteSelector* remoteSelector,
+  size_t remoteIndex,
+  bool connected);
+
+void endRemoteEjection(
+  struct RemoteSelector* remoteSelector,
+  size_t remoteIndex);
+
+bool isRemoteEjected(
+  const struct RemoteSelector* remoteSelector,
+  size_t remoteIndex);
+
+#endif
@@ -1,6 +1,7 @@
 #include "socketutil.h"
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
@@ -56,6 +57,49 @@ bool sockAddrInfoToNameAndPort(
                                addrPortStrings);
 }
 
+void sockAddrInfoToCompactSockAddr(
+  const struct SockAddrInfo* sockAddrInfo,
+  struct CompactSockAddr* compactSockAddr)
+{
+  assert(sockAddrInfo != NULL);
+  assert(compactSockAddr != NULL);
+
+  memset(compactSockAddr, 0, sizeof(struct CompactSockAddr));
+
+  if (((sockAddrInfo->sa.sa_family == AF_INET) ||
+       (sockAddrInfo->sa.sa_family == AF_INET6)) &&
+      (sockAddrInfo->saSize <= sizeof(struct CompactSockAddr)))
+  {
+    memcpy(compactSockAddr, &(sockAddrInfo->sa), sockAddrInfo->saSize);
+  }
+  else
+  {
+    compactSockAddr->sa.sa_family = AF_UNSPEC;
+  }
+}
+
+bool compactSockAddrToNameAndPort(
+  const struct CompactSockAddr* compactSockAddr,
+  struct AddrPortStrings* addrPortStrings)
+{
+  assert(compactSockAddr != NULL);
+  assert(addrPortStrings != NULL);
+
+  if (compactSockAddr->sa.sa_family == AF_INET)
+  {
+    return sockAddrToNameAndPort(&(compactSockAddr->sa),
+                                 sizeof(struct sockaddr_in),
+                                 addrPortStrings);
+  }
+  else if (compactSockAddr->sa.sa_family == AF_INET6)
+  {
+    return sockAddrToNameAndPort(&(compactSockAddr->sa),
+                                 sizeof(struct sockaddr_in6),
+                                 addrPortStrings);
+  }
+  return false;
+}
+
 bool createNonBlockingSocket(
   const struct addrinfo* addrinfo,
   int* socketFD)
@@ -83,6 +127,14 @@ bool setSocketReuseAddress(
                      &optval, sizeof(optval)) != -1);
 }
 
+bool setSocketReusePort(
+  const int socket)
+{
+  int optval = 1;
+  return (setsockopt(socket, SOL_SOCKET, SO_REUSEPORT,
+                     &optval, sizeof(optval)) != -1);
+}
+
 bool bindSocket(
   const int socket,
   const struct addrinfo* addrinfo)
@@ -92,12 +144,39 @@ bool bindSocket(
   return (bind(socket, addrinfo->ai_addr, addrinfo->ai_addrlen) != -1);
 }
 
+/* SO_SPLICE only exists on OpenBSD, elsewhere setting it always fails. */
 bool setSocketSplice(
   const int fromSocket,
   const int toSocket)
 {
+#ifdef SO_SPLICE
   return (setsockopt(fromSocket, SOL_SOCKET, SO_SPLICE,
                      &toSocket, sizeof(toSocket)) != -1);
+#else
+  errno = ENOPROTOOPT;
+  return false;
+#endif
+}
+
+/* Like setSocketSplice(), the splice dissolves with EFBIG once maxBytes
+   have moved.  maxBytes 0 is no limit. */
+bool setSocketSpliceMax(
+  const int fromSocket,
+  const int toSocket,
+  const off_t maxBytes)
+{
+#ifdef SO_SPLICE
+  struct splice splice;
+
+  memset(&splice, 0, sizeof(splice));
+  splice.sp_fd = toSocket;
+  splice.sp_max = maxBytes;
+  return (setsockopt(fromSocket, SOL_SOCKET, SO_SPLICE,
+                     &splice, sizeof(splice)) != -1);
+#else
+  errno = ENOPROTOOPT;
+  return false;
+#endif
 }
 
 bool setBidirectionalSplice(
@@ -117,7 +196,8 @@ bool setBidirectionalSplice(
 off_t getSpliceBytesTransferred(
   const int socket)
 {
-  off_t bytesTransferred;
+  off_t bytesTransferred = 0;
+#ifdef SO_SPLICE
   socklen_t optlen = sizeof(bytesTransferred);
   int retVal =
     getsockopt(socket, SOL_SOCKET, SO_SPLICE, &bytesTransferred, &optlen);
@@ -125,6 +205,7 @@ off_t getSpliceBytesTransferred(
   {
     bytesTransferred = 0;
   }
+#endif
   return bytesTransferred;
 }
 
@@ -142,6 +223,33 @@ int getSocketError(
   return optval;
 }
 
+bool shutdownSocketWrite(
+  const int socket)
+{
+  return (shutdown(socket, SHUT_WR) != -1);
+}
+
+bool isSocketPeerOpen(
+  const int socket)
+{
+  char peekByte;
+  bool interrupted;
+  ssize_t retVal;
+
+  do
+  {
+    retVal = recv(socket, &peekByte, 1, MSG_PEEK | MSG_DONTWAIT);
+    interrupted = ((retVal == -1) &&
+                   (errno == EINTR));
+  } while (interrupted);
+
+  if (retVal == -1)
+  {
+    return ((errno == EAGAIN) || (errno == EWOULDBLOCK));
+  }
+  return (retVal > 0);
+}
+
 enum AcceptSocketResult acceptSocket(
   const int socketFD,
   int* acceptFD,
@@ -189,6 +297,111 @@ enum AcceptSocketResult acceptSocket(
   return acceptSocketResult;
 }
 
+enum SocketIOResult readSocket(
+  const int socket,
+  void* buffer,
+  size_t bufferSize,
+  size_t* bytesRead)
+{
+  bool interrupted;
+  ssize_t readRetVal;
+
+  assert(bytesRead != NULL);
+
+  do
+  {
+    readRetVal = recv(socket, buffer, bufferSize, MSG_DONTWAIT);
+    interrupted =
+      ((readRetVal == -1) &&
+       (errno == EINTR));
+  } while (interrupted);
+
+  if (readRetVal == -1)
+  {
+    return (((errno == EAGAIN) || (errno == EWOULDBLOCK)) ?
+            SOCKET_IO_RESULT_WOULD_BLOCK :
+            SOCKET_IO_RESULT_ERROR);
+  }
+  else if (readRetVal == 0)
+  {
+    return SOCKET_IO_RESULT_EOF;
+  }
+
+  *bytesRead = readRetVal;
+  return SOCKET_IO_RESULT_SUCCESS;
+}
+
+enum SocketIOResult writeSocket(
+  const int socket,
+  const void* buffer,
+  size_t bufferSize,
+  size_t* bytesWritten)
+{
+  bool interrupted;
+  ssize_t writeRetVal;
+
+  assert(bytesWritten != NULL);
+
+  do
+  {
+    writeRetVal = send(socket, buffer, bufferSize, MSG_DONTWAIT);
+    interrupted =
+      ((writeRetVal == -1) &&
+       (errno == EINTR));
+  } while (interrupted);
+
+  if (writeRetVal == -1)
+  {
+    return (((errno == EAGAIN) || (errno == EWOULDBLOCK)) ?
+            SOCKET_IO_RESULT_WOULD_BLOCK :
+            SOCKET_IO_RESULT_ERROR);
+  }
+
+  *bytesWritten = writeRetVal;
+  return SOCKET_IO_RESULT_SUCCESS;
+}
+
+/* splice(2) only exists on Linux, elsewhere it always fails. */
+enum SocketIOResult spliceSocket(
+  const int fromFD,
+  const int toFD,
+  size_t maxBytes,
+  size_t* bytesSpliced)
+{
+#ifdef SPLICE_F_MOVE
+  bool interrupted;
+  ssize_t spliceRetVal;
+
+  assert(bytesSpliced != NULL);
+
+  do
+  {
+    spliceRetVal = splice(fromFD, NULL, toFD, NULL, maxBytes,
+                          SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    interrupted =
+      ((spliceRetVal == -1) &&
+       (errno == EINTR));
+  } while (interrupted);
+
+  if (spliceRetVal == -1)
+  {
+    return (((errno == EAGAIN) || (errno == EWOULDBLOCK)) ?
+            SOCKET_IO_RESULT_WOULD_BLOCK :
+            SOCKET_IO_RESULT_ERROR);
+  }
+  else if (spliceRetVal == 0)
+  {
+    return SOCKET_IO_RESULT_EOF;
+  }
+
+  *bytesSpliced = spliceRetVal;
+  return SOCKET_IO_RESULT_SUCCESS;
+#else
+  errno = ENOSYS;
+  return SOCKET_IO_RESULT_ERROR;
+#endif
+}
+
 bool getSocketName(
   const int socketFD,
   struct SockAddrInfo* sockAddrInfo)
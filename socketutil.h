@@ -3,6 +3,7 @@
 
 #include <netdb.h>
 #include <stdbool.h>
+#include <netinet/in.h>
 #include <sys/socket.h>
 
 struct SockAddrInfo
@@ -15,6 +16,18 @@ struct SockAddrInfo
   socklen_t saSize;
 };
 
+/* IPv4 or IPv6 address in the space it needs rather than a whole
+   sockaddr_storage, sa_family is AF_UNSPEC for anything else. */
+struct CompactSockAddr
+{
+  union
+  {
+    struct sockaddr sa;
+    struct sockaddr_in sin;
+    struct sockaddr_in6 sin6;
+  };
+};
+
 #define MAX_ADDR_STRING_LENGTH (50)
 #define MAX_PORT_STRING_LENGTH (6)
 
@@ -32,6 +45,14 @@ bool sockAddrInfoToNameAndPort(
   const struct SockAddrInfo* sockAddrInfo,
   struct AddrPortStrings* addrPortStrings);
 
+void sockAddrInfoToCompactSockAddr(
+  const struct SockAddrInfo* sockAddrInfo,
+  struct CompactSockAddr* compactSockAddr);
+
+bool compactSockAddrToNameAndPort(
+  const struct CompactSockAddr* compactSockAddr,
+  struct AddrPortStrings* addrPortStrings);
+
 bool createNonBlockingSocket(
   const struct addrinfo* addrinfo,
   int* socketFD);
@@ -42,6 +63,9 @@ bool setSocketListening(
 bool setSocketReuseAddress(
   const int socket);
 
+bool setSocketReusePort(
+  const int socket);
+
 bool bindSocket(
   const int socket,
   const struct addrinfo* addrinfo);
@@ -50,6 +74,11 @@ bool setSocketSplice(
   const int fromSocket,
   const int toSocket);
 
+bool setSocketSpliceMax(
+  const int fromSocket,
+  const int toSocket,
+  const off_t maxBytes);
+
 bool setBidirectionalSplice(
   const int socket1,
   const int socket2);
@@ -60,6 +89,16 @@ off_t getSpliceBytesTransferred(
 int getSocketError(
   const int socket);
 
+/* Sends a FIN once everything already written has been sent, the
+   socket can still read. */
+bool shutdownSocketWrite(
+  const int socket);
+
+/* False once a connected socket has seen the peer's FIN or an error.
+   Data waiting to be read is left in the socket. */
+bool isSocketPeerOpen(
+  const int socket);
+
 enum AcceptSocketResult
 {
   ACCEPT_SOCKET_RESULT_ERROR,
@@ -76,6 +115,37 @@ bool getSocketName(
   const int socketFD,
   struct SockAddrInfo* sockAddrInfo);
 
+/* readSocket() and writeSocket() never block, whatever the socket's
+   O_NONBLOCK flag (accepted sockets do not inherit it everywhere). */
+enum SocketIOResult
+{
+  SOCKET_IO_RESULT_ERROR,
+  SOCKET_IO_RESULT_SUCCESS,
+  SOCKET_IO_RESULT_WOULD_BLOCK,
+  SOCKET_IO_RESULT_EOF
+};
+
+enum SocketIOResult readSocket(
+  const int socket,
+  void* buffer,
+  size_t bufferSize,
+  size_t* bytesRead);
+
+enum SocketIOResult writeSocket(
+  const int socket,
+  const void* buffer,
+  size_t bufferSize,
+  size_t* bytesWritten);
+
+/* Moves up to maxBytes from a socket into a pipe or from a pipe into a
+   socket without copying through userspace.  The socket must be
+   non-blocking, splice(2) does not make it so. */
+enum SocketIOResult spliceSocket(
+  const int fromFD,
+  const int toFD,
+  size_t maxBytes,
+  size_t* bytesSpliced);
+
 enum ConnectSocketResult
 {
   CONNECT_SOCKET_RESULT_ERROR,
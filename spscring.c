@@ -0,0 +1,116 @@
+#include "spscring.h"
+#include "memutil.h"
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define CACHE_LINE_SIZE (64)
+
+/*
+ * head and tail only ever increase and are reduced modulo the capacity
+ * on access.  Each index is written by one side only and lives on its
+ * own cache line.
+ */
+struct SPSCRing
+{
+  _Alignas(CACHE_LINE_SIZE) atomic_size_t head;
+  _Alignas(CACHE_LINE_SIZE) atomic_size_t tail;
+  _Alignas(CACHE_LINE_SIZE) size_t capacityMask;
+  size_t elementSize;
+  unsigned char* elementArray;
+};
+
+struct SPSCRing* newSPSCRing(
+  size_t capacity,
+  size_t elementSize)
+{
+  struct SPSCRing* spscRing;
+
+  if ((capacity == 0) || ((capacity & (capacity - 1)) != 0))
+  {
+    printf("SPSCRing capacity %zu is not a power of 2\n", capacity);
+    abort();
+  }
+
+  spscRing = checkedCallocOne(sizeof(struct SPSCRing));
+  atomic_init(&(spscRing->head), 0);
+  atomic_init(&(spscRing->tail), 0);
+  spscRing->capacityMask = capacity - 1;
+  spscRing->elementSize = elementSize;
+  spscRing->elementArray =
+    checkedReallocarray(NULL, capacity, elementSize);
+
+  return spscRing;
+}
+
+bool pushSPSCRing(
+  struct SPSCRing* spscRing,
+  const void* element)
+{
+  size_t tail;
+  size_t head;
+
+  assert(spscRing != NULL);
+
+  tail = atomic_load_explicit(&(spscRing->tail), memory_order_relaxed);
+  head = atomic_load_explicit(&(spscRing->head), memory_order_acquire);
+
+  if ((tail - head) > spscRing->capacityMask)
+  {
+    return false;
+  }
+
+  memcpy(spscRing->elementArray +
+         ((tail & spscRing->capacityMask) * spscRing->elementSize),
+         element,
+         spscRing->elementSize);
+
+  atomic_store_explicit(&(spscRing->tail), tail + 1, memory_order_release);
+
+  return true;
+}
+
+bool popSPSCRing(
+  struct SPSCRing* spscRing,
+  void* element)
+{
+  size_t head;
+  size_t tail;
+
+  assert(spscRing != NULL);
+
+  head = atomic_load_explicit(&(spscRing->head), memory_order_relaxed);
+  tail = atomic_load_explicit(&(spscRing->tail), memory_order_acquire);
+
+  if (head == tail)
+  {
+    return false;
+  }
+
+  memcpy(element,
+         spscRing->elementArray +
+         ((head & spscRing->capacityMask) * spscRing->elementSize),
+         spscRing->elementSize);
+
+  atomic_store_explicit(&(spscRing->head), head + 1, memory_order_release);
+
+  return true;
+}
+
+size_t getSPSCRingSize(
+  const struct SPSCRing* spscRing)
+{
+  size_t head;
+  size_t tail;
+
+  assert(spscRing != NULL);
+
+  head = atomic_load_explicit(
+    (atomic_size_t*)&(spscRing->head), memory_order_relaxed);
+  tail = atomic_load_explicit(
+    (atomic_size_t*)&(spscRing->tail), memory_order_relaxed);
+
+  return ((tail >= head) ? (tail - head) : 0);
+}
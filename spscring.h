@@ -0,0 +1,26 @@
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Bounded lock-free ring for one producer thread and one consumer thread.
+   Elements are copied in and out by value. */
+struct SPSCRing;
+
+struct SPSCRing* newSPSCRing(
+  size_t capacity,
+  size_t elementSize);
+
+bool pushSPSCRing(
+  struct SPSCRing* spscRing,
+  const void* element);
+
+bool popSPSCRing(
+  struct SPSCRing* spscRing,
+  void* element);
+
+size_t getSPSCRingSize(
+  const struct SPSCRing* spscRing);
+
+#endif
@@ -0,0 +1,311 @@
+#include "timerwheel.h"
+#include "memutil.h"
+#include <assert.h>
+#include <limits.h>
+
+/*
+ * Hierarchical timing wheel with 1 millisecond ticks.  Level 0 holds
+ * entries expiring within the next 256 ms, each higher level covers 256
+ * times the range of the one below and is cascaded down one slot at a
+ * time as the lower level wraps.  Insert and remove are O(1).
+ */
+
+#define TIMER_WHEEL_LEVELS (4)
+#define TIMER_WHEEL_SLOT_BITS (8)
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+#define TIMER_WHEEL_SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+#define MAX_TIMER_WHEEL_DELTA_MS \
+  ((((uint64_t)1) << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOT_BITS)) - 1)
+
+struct TimerWheelLevel
+{
+  struct TimerWheelEntryList slotArray[TIMER_WHEEL_SLOTS];
+  size_t numEntries;
+};
+
+struct TimerWheel
+{
+  uint64_t currentTimeMS;
+  size_t numEntries;
+  struct TimerWheelLevel levelArray[TIMER_WHEEL_LEVELS];
+};
+
+struct TimerWheel* newTimerWheel(
+  uint64_t nowMS)
+{
+  struct TimerWheel* timerWheel = checkedCallocOne(sizeof(struct TimerWheel));
+  unsigned int level;
+  unsigned int slot;
+
+  timerWheel->currentTimeMS = nowMS;
+
+  for (level = 0; level < TIMER_WHEEL_LEVELS; ++level)
+  {
+    for (slot = 0; slot < TIMER_WHEEL_SLOTS; ++slot)
+    {
+      TAILQ_INIT(&(timerWheel->levelArray[level].slotArray[slot]));
+    }
+  }
+
+  return timerWheel;
+}
+
+static unsigned int getLevelShift(
+  unsigned int level)
+{
+  return (level * TIMER_WHEEL_SLOT_BITS);
+}
+
+static void placeTimerWheelEntry(
+  struct TimerWheel* timerWheel,
+  struct TimerWheelEntry* timerWheelEntry,
+  uint64_t placeTimeMS)
+{
+  uint64_t deltaMS = placeTimeMS - timerWheel->currentTimeMS;
+  unsigned int level = 0;
+  unsigned int slot;
+
+  if (deltaMS > MAX_TIMER_WHEEL_DELTA_MS)
+  {
+    /* re-placed when cascaded, the real expire time is kept in the entry */
+    deltaMS = MAX_TIMER_WHEEL_DELTA_MS;
+    placeTimeMS = timerWheel->currentTimeMS + deltaMS;
+  }
+
+  while (deltaMS >= (((uint64_t)1) << getLevelShift(level + 1)))
+  {
+    ++level;
+  }
+
+  slot = (placeTimeMS >> getLevelShift(level)) & TIMER_WHEEL_SLOT_MASK;
+
+  TAILQ_INSERT_TAIL(
+    &(timerWheel->levelArray[level].slotArray[slot]),
+    timerWheelEntry, entry);
+  timerWheelEntry->level = level;
+  timerWheelEntry->slot = slot;
+  timerWheelEntry->pending = true;
+
+  ++(timerWheel->levelArray[level].numEntries);
+  ++(timerWheel->numEntries);
+}
+
+static void unlinkTimerWheelEntry(
+  struct TimerWheel* timerWheel,
+  struct TimerWheelEntry* timerWheelEntry)
+{
+  TAILQ_REMOVE(
+    &(timerWheel->levelArray[timerWheelEntry->level].slotArray[
+        timerWheelEntry->slot]),
+    timerWheelEntry, entry);
+  timerWheelEntry->pending = false;
+
+  --(timerWheel->levelArray[timerWheelEntry->level].numEntries);
+  --(timerWheel->numEntries);
+}
+
+void addTimerWheelEntry(
+  struct TimerWheel* timerWheel,
+  struct TimerWheelEntry* timerWheelEntry,
+  uint64_t expireTimeMS)
+{
+  assert(timerWheel != NULL);
+  assert(timerWheelEntry != NULL);
+
+  if (timerWheelEntry->pending)
+  {
+    unlinkTimerWheelEntry(timerWheel, timerWheelEntry);
+  }
+
+  timerWheelEntry->expireTimeMS = expireTimeMS;
+
+  /* already due entries fire on the next tick */
+  placeTimerWheelEntry(
+    timerWheel,
+    timerWheelEntry,
+    ((expireTimeMS > timerWheel->currentTimeMS) ?
+     expireTimeMS :
+     (timerWheel->currentTimeMS + 1)));
+}
+
+void removeTimerWheelEntry(
+  struct TimerWheel* timerWheel,
+  struct TimerWheelEntry* timerWheelEntry)
+{
+  assert(timerWheel != NULL);
+  assert(timerWheelEntry != NULL);
+
+  if (timerWheelEntry->pending)
+  {
+    unlinkTimerWheelEntry(timerWheel, timerWheelEntry);
+  }
+}
+
+size_t getTimerWheelNumEntries(
+  const struct TimerWheel* timerWheel)
+{
+  assert(timerWheel != NULL);
+
+  return timerWheel->numEntries;
+}
+
+int getTimerWheelTimeoutMS(
+  const struct TimerWheel* timerWheel,
+  uint64_t nowMS)
+{
+  uint64_t nextTimeMS = UINT64_MAX;
+  unsigned int level;
+
+  assert(timerWheel != NULL);
+
+  if (timerWheel->numEntries == 0)
+  {
+    return -1;
+  }
+
+  /*
+   * For level 0 this is the first expiring slot, for higher levels the
+   * time their first occupied slot is cascaded down.  The current slot of
+   * a higher level was cascaded when it was entered, so its entries are a
+   * full revolution away, offset TIMER_WHEEL_SLOTS.
+   */
+  for (level = 0; level < TIMER_WHEEL_LEVELS; ++level)
+  {
+    const struct TimerWheelLevel* timerWheelLevel =
+      &(timerWheel->levelArray[level]);
+    const uint64_t levelTime =
+      timerWheel->currentTimeMS >> getLevelShift(level);
+    unsigned int i;
+
+    if (timerWheelLevel->numEntries == 0)
+    {
+      continue;
+    }
+
+    for (i = 1; i <= TIMER_WHEEL_SLOTS; ++i)
+    {
+      const unsigned int slot = (levelTime + i) & TIMER_WHEEL_SLOT_MASK;
+      if (!TAILQ_EMPTY(&(timerWheelLevel->slotArray[slot])))
+      {
+        const uint64_t slotTimeMS = (levelTime + i) << getLevelShift(level);
+        if (slotTimeMS < nextTimeMS)
+        {
+          nextTimeMS = slotTimeMS;
+        }
+        break;
+      }
+    }
+  }
+
+  if (nextTimeMS <= nowMS)
+  {
+    return 0;
+  }
+  else if ((nextTimeMS - nowMS) > INT_MAX)
+  {
+    return INT_MAX;
+  }
+  return (nextTimeMS - nowMS);
+}
+
+static size_t cascadeTimerWheelLevel(
+  struct TimerWheel* timerWheel,
+  unsigned int level,
+  struct TimerWheelEntryList* expiredList)
+{
+  const unsigned int slot =
+    (timerWheel->currentTimeMS >> getLevelShift(level)) &
+    TIMER_WHEEL_SLOT_MASK;
+  struct TimerWheelEntryList* slotList =
+    &(timerWheel->levelArray[level].slotArray[slot]);
+  struct TimerWheelEntry* timerWheelEntry;
+  size_t numExpired = 0;
+
+  while ((timerWheelEntry = TAILQ_FIRST(slotList)) != NULL)
+  {
+    unlinkTimerWheelEntry(timerWheel, timerWheelEntry);
+    if (timerWheelEntry->expireTimeMS <= timerWheel->currentTimeMS)
+    {
+      TAILQ_INSERT_TAIL(expiredList, timerWheelEntry, entry);
+      ++numExpired;
+    }
+    else
+    {
+      placeTimerWheelEntry(
+        timerWheel, timerWheelEntry, timerWheelEntry->expireTimeMS);
+    }
+  }
+
+  if ((slot == 0) && ((level + 1) < TIMER_WHEEL_LEVELS))
+  {
+    numExpired += cascadeTimerWheelLevel(timerWheel, level + 1, expiredList);
+  }
+
+  return numExpired;
+}
+
+static size_t expireTimerWheelSlot(
+  struct TimerWheel* timerWheel,
+  struct TimerWheelEntryList* expiredList)
+{
+  const unsigned int slot =
+    timerWheel->currentTimeMS & TIMER_WHEEL_SLOT_MASK;
+  struct TimerWheelEntryList* slotList =
+    &(timerWheel->levelArray[0].slotArray[slot]);
+  struct TimerWheelEntry* timerWheelEntry;
+  size_t numExpired = 0;
+
+  while ((timerWheelEntry = TAILQ_FIRST(slotList)) != NULL)
+  {
+    unlinkTimerWheelEntry(timerWheel, timerWheelEntry);
+    TAILQ_INSERT_TAIL(expiredList, timerWheelEntry, entry);
+    ++numExpired;
+  }
+
+  return numExpired;
+}
+
+size_t expireTimerWheelEntries(
+  struct TimerWheel* timerWheel,
+  uint64_t nowMS,
+  struct TimerWheelEntryList* expiredList)
+{
+  size_t numExpired = 0;
+
+  assert(timerWheel != NULL);
+  assert(expiredList != NULL);
+
+  while (timerWheel->currentTimeMS < nowMS)
+  {
+    if (timerWheel->numEntries == 0)
+    {
+      timerWheel->currentTimeMS = nowMS;
+      break;
+    }
+
+    if (timerWheel->levelArray[0].numEntries == 0)
+    {
+      /* nothing can expire before level 0 wraps and cascades */
+      const uint64_t nextWrapMS =
+        (timerWheel->currentTimeMS | TIMER_WHEEL_SLOT_MASK) + 1;
+      if (nextWrapMS > nowMS)
+      {
+        timerWheel->currentTimeMS = nowMS;
+        break;
+      }
+      timerWheel->currentTimeMS = nextWrapMS;
+    }
+    else
+    {
+      ++(timerWheel->currentTimeMS);
+    }
+
+    if ((timerWheel->currentTimeMS & TIMER_WHEEL_SLOT_MASK) == 0)
+    {
+      numExpired += cascadeTimerWheelLevel(timerWheel, 1, expiredList);
+    }
+    numExpired += expireTimerWheelSlot(timerWheel, expiredList);
+  }
+
+  return numExpired;
+}
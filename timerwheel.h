@@ -0,0 +1,49 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/queue.h>
+
+struct TimerWheelEntry
+{
+  TAILQ_ENTRY(TimerWheelEntry) entry;
+  uint64_t expireTimeMS;
+  unsigned int level;
+  unsigned int slot;
+  bool pending;
+};
+
+TAILQ_HEAD(TimerWheelEntryList, TimerWheelEntry);
+
+struct TimerWheel;
+
+struct TimerWheel* newTimerWheel(
+  uint64_t nowMS);
+
+void addTimerWheelEntry(
+  struct TimerWheel* timerWheel,
+  struct TimerWheelEntry* timerWheelEntry,
+  uint64_t expireTimeMS);
+
+void removeTimerWheelEntry(
+  struct TimerWheel* timerWheel,
+  struct TimerWheelEntry* timerWheelEntry);
+
+size_t getTimerWheelNumEntries(
+  const struct TimerWheel* timerWheel);
+
+/* Milliseconds until the wheel next needs to be advanced, -1 if empty. */
+int getTimerWheelTimeoutMS(
+  const struct TimerWheel* timerWheel,
+  uint64_t nowMS);
+
+/* Append all entries expiring at or before nowMS to expiredList, in
+   expiry order. */
+size_t expireTimerWheelEntries(
+  struct TimerWheel* timerWheel,
+  uint64_t nowMS,
+  struct TimerWheelEntryList* expiredList);
+
+#endif
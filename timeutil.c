@@ -9,7 +9,7 @@ void printTimeString(FILE* fp)
   size_t charsWritten;
   char buffer[80];
   struct timeval tv;
-  struct tm* tm;
+  struct tm tm;
 
   if (gettimeofday(&tv, NULL) == -1)
   {
@@ -17,14 +17,13 @@ void printTimeString(FILE* fp)
     abort();
   }
 
-  tm = localtime(&tv.tv_sec);
-  if (tm == NULL)
+  if (localtime_r(&tv.tv_sec, &tm) == NULL)
   {
-    printf("localtime error\n");
+    printf("localtime_r error\n");
     abort();
   }
 
-  charsWritten = strftime(buffer, sizeof(buffer), "%Y-%b-%d %H:%M:%S", tm);
+  charsWritten = strftime(buffer, sizeof(buffer), "%Y-%b-%d %H:%M:%S", &tm);
   if (charsWritten == 0)
   {
     printf("strftime error\n");
@@ -40,3 +39,30 @@ void printTimeString(FILE* fp)
 
   fputs(buffer, fp);
 }
+
+static void getMonotonicTime(struct timespec* ts)
+{
+  if (clock_gettime(CLOCK_MONOTONIC, ts) == -1)
+  {
+    printf("clock_gettime error\n");
+    abort();
+  }
+}
+
+uint64_t getMonotonicTimeMS()
+{
+  struct timespec ts;
+
+  getMonotonicTime(&ts);
+
+  return ((((uint64_t)ts.tv_sec) * 1000) + (ts.tv_nsec / 1000000));
+}
+
+uint64_t getMonotonicTimeUS()
+{
+  struct timespec ts;
+
+  getMonotonicTime(&ts);
+
+  return ((((uint64_t)ts.tv_sec) * 1000000) + (ts.tv_nsec / 1000));
+}
@@ -1,8 +1,13 @@
 #ifndef TIMEUTIL_H
 #define TIMEUTIL_H
 
+#include <stdint.h>
 #include <stdio.h>
 
 void printTimeString(FILE* fp);
 
+uint64_t getMonotonicTimeMS();
+
+uint64_t getMonotonicTimeUS();
+
 #endif
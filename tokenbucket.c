@@ -0,0 +1,61 @@
+#include "tokenbucket.h"
+#include <assert.h>
+#include <stddef.h>
+
+void initTokenBucket(
+  struct TokenBucket* tokenBucket,
+  uint64_t bytesPerSecond,
+  uint32_t refillMilliseconds)
+{
+  assert(tokenBucket != NULL);
+  assert(refillMilliseconds > 0);
+
+  tokenBucket->tokensPerRefill =
+    (bytesPerSecond / 1000) * refillMilliseconds +
+    ((bytesPerSecond % 1000) * refillMilliseconds) / 1000;
+  if (tokenBucket->tokensPerRefill == 0)
+  {
+    tokenBucket->tokensPerRefill = 1;
+  }
+  tokenBucket->tokens = tokenBucket->tokensPerRefill;
+}
+
+void refillTokenBucket(
+  struct TokenBucket* tokenBucket)
+{
+  assert(tokenBucket != NULL);
+
+  tokenBucket->tokens = tokenBucket->tokensPerRefill;
+}
+
+uint64_t getTokenBucketTokens(
+  const struct TokenBucket* tokenBucket)
+{
+  assert(tokenBucket != NULL);
+
+  return tokenBucket->tokens;
+}
+
+uint64_t getTokenBucketTokensPerRefill(
+  const struct TokenBucket* tokenBucket)
+{
+  assert(tokenBucket != NULL);
+
+  return tokenBucket->tokensPerRefill;
+}
+
+void takeTokenBucketTokens(
+  struct TokenBucket* tokenBucket,
+  uint64_t numTokens)
+{
+  assert(tokenBucket != NULL);
+
+  if (numTokens >= tokenBucket->tokens)
+  {
+    tokenBucket->tokens = 0;
+  }
+  else
+  {
+    tokenBucket->tokens -= numTokens;
+  }
+}
@@ -0,0 +1,35 @@
+#ifndef TOKENBUCKET_H
+#define TOKENBUCKET_H
+
+#include <stdint.h>
+
+/* Byte rate limit refilled by a periodic timer.  The bucket holds at
+   most one refill worth of tokens, so an idle bucket cannot build up a
+   burst larger than one refill period. */
+struct TokenBucket
+{
+  uint64_t tokensPerRefill;
+  uint64_t tokens;
+};
+
+/* Starts full.  Every refill adds at least one token. */
+void initTokenBucket(
+  struct TokenBucket* tokenBucket,
+  uint64_t bytesPerSecond,
+  uint32_t refillMilliseconds);
+
+void refillTokenBucket(
+  struct TokenBucket* tokenBucket);
+
+uint64_t getTokenBucketTokens(
+  const struct TokenBucket* tokenBucket);
+
+uint64_t getTokenBucketTokensPerRefill(
+  const struct TokenBucket* tokenBucket);
+
+/* Taking more tokens than available empties the bucket. */
+void takeTokenBucketTokens(
+  struct TokenBucket* tokenBucket,
+  uint64_t numTokens);
+
+#endif